@@ -0,0 +1,109 @@
+#include "batch_tuner.h"
+#include "constants.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <torch/cuda.h>
+#include <torch/torch.h>
+
+std::vector<size_t> batchSizes(size_t maxBatch) {
+  std::vector<size_t> sizes;
+  for (size_t size = 1; size < maxBatch; size *= 2) {
+    sizes.push_back(size);
+  }
+  sizes.push_back(maxBatch);
+  return sizes;
+}
+
+// the value share of the way through values once sorted.
+static double percentile(std::vector<double> values, double share) {
+  std::sort(values.begin(), values.end());
+  size_t i = std::min(values.size() - 1,
+                      static_cast<size_t>(share * values.size()));
+  return values[i];
+}
+
+// runs the warmup and timed passes of one size and adds the timed
+// latencies to latencies.
+static void timePasses(DNN &model, const torch::Device &device, size_t size,
+                       std::vector<double> &latencies) {
+  torch::NoGradGuard no_grad;
+  torch::Tensor input =
+      torch::randn({static_cast<int64_t>(size), INPUT_PLANES, 8, 8},
+                   torch::TensorOptions().device(device));
+
+  for (int pass = 0; pass < WARMUP_PASSES + TIMED_PASSES; pass++) {
+    auto start = std::chrono::steady_clock::now();
+    model->forward(input);
+    // cuda kernels run asynchronously, so wait for them to finish.
+    if (device.is_cuda()) {
+      torch::cuda::synchronize();
+    }
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    if (pass >= WARMUP_PASSES) {
+      latencies.push_back(ms);
+    }
+  }
+}
+
+std::vector<BatchTiming> sweepBatchSizes(DNN &model,
+                                         const torch::Device &device,
+                                         const std::vector<size_t> &sizes,
+                                         int concurrency) {
+  concurrency = std::max(concurrency, 1);
+  std::vector<BatchTiming> timings;
+  for (size_t size : sizes) {
+    // concurrent passes share the cores, so each one's latency is what a
+    // game would see with the others running.
+    std::vector<std::vector<double>> perThread(concurrency);
+    std::vector<std::thread> threads;
+    for (int i = 1; i < concurrency; i++) {
+      threads.emplace_back(
+          [&, i] { timePasses(model, device, size, perThread[i]); });
+    }
+    timePasses(model, device, size, perThread[0]);
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+
+    std::vector<double> latencies;
+    for (const std::vector<double> &thread : perThread) {
+      latencies.insert(latencies.end(), thread.begin(), thread.end());
+    }
+    double mean = 0;
+    for (double ms : latencies) {
+      mean += ms / latencies.size();
+    }
+    timings.push_back({size, percentile(latencies, 0.5),
+                       percentile(latencies, 0.99),
+                       concurrency * size / mean * 1000});
+  }
+  return timings;
+}
+
+size_t chooseBatchSize(const std::vector<BatchTiming> &timings, double capMs) {
+  const BatchTiming *best = nullptr;
+  for (const BatchTiming &timing : timings) {
+    if (timing.p99Ms > capMs) {
+      continue;
+    }
+    if (best == nullptr ||
+        timing.positionsPerSecond > best->positionsPerSecond) {
+      best = &timing;
+    }
+  }
+  if (best == nullptr) {
+    return timings.empty() ? 1 : timings.front().batchSize;
+  }
+  return best->batchSize;
+}
+
+size_t tuneBatchSize(DNN &model, const torch::Device &device,
+                     int concurrency) {
+  return chooseBatchSize(sweepBatchSizes(model, device,
+                                         batchSizes(MAX_BATCH_SIZE),
+                                         concurrency),
+                         BATCH_LATENCY_CAP_MS);
+}
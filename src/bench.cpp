@@ -0,0 +1,383 @@
+#include "batch_tuner.h"
+#include "constants.h"
+#include "create_state.h"
+#include "create_state_fast.h"
+#include "dnn.h"
+#include "mcts.h"
+#include "move_gen.h"
+#include "tablebase.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <torch/cuda.h>
+#include <torch/torch.h>
+#include <vector>
+
+// positions searched by the benchmark. the first three come from move_gen.h,
+// the rest are the remaining standard perft positions.
+static const std::vector<std::pair<std::string, std::string>> BENCH_FENS = {
+    {"start", Midnight::START_FEN},
+    {"kiwipete", Midnight::KIWIPETE_FEN},
+    {"talkchess", Midnight::TALKCHESS_FEN},
+    {"endgame", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1"},
+    {"promotions",
+     "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1"},
+    {"middlegame", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/"
+                   "R4RK1 w - - 0 10"},
+};
+
+// peak resident set size of the process in megabytes.
+static double maxResidentMB() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024.0;
+}
+
+static void printStats(const std::string &name, const SearchStats &stats,
+                       double seconds) {
+  double searchTime = stats.selectionTime + stats.encodingTime +
+                      stats.inferenceTime + stats.backupTime;
+  if (searchTime == 0) {
+    searchTime = 1;
+  }
+  double occupancy =
+      stats.batches == 0
+          ? 0
+          : static_cast<double>(stats.nnEvals) / stats.batches / BATCH_SIZE;
+
+  double searches = stats.searches == 0 ? 1 : stats.searches;
+  double batches = stats.batches == 0 ? 1 : stats.batches;
+  double collisions = stats.collisions / batches;
+
+  // edges per search is what allocating every child on expansion would
+  // cost, nodes per search what lazy allocation actually created.
+  std::printf("%-12s %10.0f %10.0f %8.1f%% %8.1f | %5.1f%% %5.1f%% %5.1f%% "
+              "%5.1f%% | %8.0f %8.0f\n",
+              name.c_str(), stats.simulations / seconds,
+              stats.nnEvals / seconds, occupancy * 100, collisions,
+              stats.selectionTime / searchTime * 100,
+              stats.encodingTime / searchTime * 100,
+              stats.inferenceTime / searchTime * 100,
+              stats.backupTime / searchTime * 100,
+              stats.nodesAllocated / searches, stats.edges / searches);
+}
+
+// collects up to limit visited nodes of the tree in breadth first order.
+// unvisited children have no encoded planes yet.
+static std::vector<Node *> collectNodes(Node *tree, size_t limit) {
+  std::vector<Node *> nodes;
+  std::deque<Node *> queue = {tree};
+  while (!queue.empty() && nodes.size() < limit) {
+    Node *node = queue.front();
+    queue.pop_front();
+    if (node->repetitions < 0) {
+      continue;
+    }
+    nodes.push_back(node);
+    for (const Edge &edge : node->edges) {
+      if (edge.child != nullptr) {
+        queue.push_back(edge.child);
+      }
+    }
+  }
+  return nodes;
+}
+
+// microseconds per position of createState and createStateFast on the same
+// batches, and whether their planes match.
+struct EncodingResult {
+  double stateUs = 0;
+  double fastUs = 0;
+  bool match = true;
+};
+
+static EncodingResult benchEncoding(Node *tree) {
+  std::vector<Node *> nodes = collectNodes(tree, 64 * BATCH_SIZE);
+  const size_t batches = nodes.size() / BATCH_SIZE;
+  EncodingResult result;
+  if (batches == 0) {
+    return result;
+  }
+
+  for (size_t i = 0; i < batches; i++) {
+    Node **begin = nodes.data() + i * BATCH_SIZE;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<torch::Tensor> states;
+    for (Node **node = begin; node != begin + BATCH_SIZE; node++) {
+      states.push_back(createState(constructHistory(*node), torch::kCPU));
+    }
+    torch::Tensor state = torch::stack(states);
+    result.stateUs += std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+
+    start = std::chrono::steady_clock::now();
+    torch::Tensor fast =
+        createStateFast(begin, begin + BATCH_SIZE, torch::kCPU);
+    result.fastUs += std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+
+    result.match = result.match && torch::equal(state, fast);
+  }
+
+  double positions = batches * BATCH_SIZE;
+  result.stateUs = result.stateUs / positions * 1e6;
+  result.fastUs = result.fastUs / positions * 1e6;
+  return result;
+}
+
+// compares root-parallel search with 1, 2, 4, ... trees on the same fixed
+// simulation searches over BENCH_FENS. one tree is plain single-tree
+// search. every tree runs the full simulation budget, so the rate is what a
+// wider machine buys per move. torch gets one thread per tree so the
+// scaling measured is the search's, not the convolutions'.
+static void benchScaling(int maxTrees, int plies, unsigned seed) {
+  at::set_num_threads(1);
+  std::printf("%-6s %10s %10s %10s %8s %10s\n", "trees", "nodes/s",
+              "evals/s", "evals/move", "speedup", "efficiency");
+
+  double single = 0;
+  for (int trees = 1; trees <= maxTrees; trees *= 2) {
+    // the same seed gives every tree the same weights.
+    std::vector<DNN> models;
+    for (int i = 0; i < trees; i++) {
+      torch::manual_seed(seed);
+      models.push_back(DNN());
+    }
+    std::srand(seed);
+
+    SearchStats total = {};
+    double seconds = 0;
+    for (const auto &[name, fen] : BENCH_FENS) {
+      GlobalData g = GlobalData(torch::kCPU, nullptr);
+      Node *root = new Node(nullptr, Midnight::SharedPosition(fen));
+      Node *tree = root;
+
+      auto start = std::chrono::steady_clock::now();
+      for (int ply = 0; ply < plies && !isTerminal(root->position); ply++) {
+        Node *selected =
+            trees == 1 ? getNextMove(root, models[0], 1.0f, g)
+                       : getNextMoveRootParallel(root, models, 1.0f, g);
+        root = advanceRoot(root, selected, g);
+      }
+      seconds += std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+      delete tree;
+      total += g.stats;
+    }
+
+    double rate = total.simulations / seconds;
+    if (trees == 1) {
+      single = rate;
+    }
+    double searches = total.searches == 0 ? 1 : total.searches;
+    std::printf("%-6d %10.0f %10.0f %10.1f %7.2fx %9.1f%%\n", trees, rate,
+                total.nnEvals / seconds, total.nnEvals / searches,
+                rate / single, rate / single / trees * 100);
+  }
+}
+
+// plays plies moves from each of BENCH_FENS with tree reuse, once leaving
+// the kept subtree where it was allocated and once compacting it after
+// every move. both runs search identical trees, so the difference in
+// nodes/s is memory locality less the compaction itself.
+static void benchCompaction(int plies, unsigned seed) {
+  std::printf("%-10s %10s %10s %12s %14s\n", "compact", "nodes/s",
+              "nodes", "compact ms", "nodes moved");
+  for (bool compact : {false, true}) {
+    torch::manual_seed(seed);
+    std::srand(seed);
+    DNN model = DNN();
+
+    SearchStats total = {};
+    double seconds = 0;
+    for (const auto &[name, fen] : BENCH_FENS) {
+      GlobalData g = GlobalData(torch::kCPU, nullptr);
+      g.compact = compact;
+      Node *root = new Node(nullptr, Midnight::SharedPosition(fen));
+      Node *game = root;
+
+      auto start = std::chrono::steady_clock::now();
+      for (int ply = 0; ply < plies && !isTerminal(root->position); ply++) {
+        Node *selected = getNextMove(root, model, 1.0f, g);
+        root = advanceRoot(root, selected, g);
+      }
+      seconds += std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+      delete game;
+      total += g.stats;
+    }
+
+    double searches = total.searches == 0 ? 1 : total.searches;
+    std::printf("%-10s %10.0f %10lu %12.2f %14.0f\n", compact ? "on" : "off",
+                total.simulations / seconds, total.simulations,
+                total.compactionTime / searches * 1000,
+                total.nodesCompacted / searches);
+  }
+}
+
+// times forward passes at every batch size up to maxBatch, threads at
+// once, and marks the size the startup tuner would choose under capMs.
+// runs on the gpu when there is one.
+static void benchSweep(size_t maxBatch, double capMs, int threads) {
+  torch::Device device = torch::cuda::is_available()
+                             ? torch::Device(torch::kCUDA, 0)
+                             : torch::Device(torch::kCPU);
+  DNN model = DNN();
+  model->to(device);
+
+  std::vector<BatchTiming> timings =
+      sweepBatchSizes(model, device, batchSizes(maxBatch), threads);
+  size_t chosen = chooseBatchSize(timings, capMs);
+  std::printf("%s, %d at once, p99 cap %.1f ms\n",
+              device.is_cuda() ? "cuda" : "cpu", threads, capMs);
+  std::printf("%-8s %10s %10s %12s\n", "batch", "p50 ms", "p99 ms",
+              "positions/s");
+  for (const BatchTiming &timing : timings) {
+    std::printf("%-8zu %10.2f %10.2f %12.0f%s\n", timing.batchSize,
+                timing.p50Ms, timing.p99Ms, timing.positionsPerSecond,
+                timing.batchSize == chosen ? "  <- chosen" : "");
+  }
+}
+
+// runs fixed-seed searches over BENCH_FENS with tree reuse and reports
+// search throughput, then compares the two input encoders on the game path
+// and the last kept subtree. with a clock
+// the searches are time managed, each side starting with clock ms. graph
+// 1 searches a graph over transpositions instead of a tree, and tree MB
+// caps each position's tree.
+// usage: bench [plies per position] [seed] [clock ms] [increment ms] [graph]
+//              [tree MB]
+//        bench scaling [max trees] [plies per position] [seed]
+//        bench compact [plies per position] [seed]
+//        bench sweep [max batch] [p99 cap ms] [threads]
+int main(int argc, char **argv) {
+  if (argc > 1 && std::string(argv[1]) == "sweep") {
+    size_t maxBatch = argc > 2 ? std::atoi(argv[2]) : MAX_BATCH_SIZE;
+    double capMs = argc > 3 ? std::atof(argv[3]) : BATCH_LATENCY_CAP_MS;
+    int threads = argc > 4 ? std::atoi(argv[4]) : 1;
+    torch::manual_seed(0);
+    benchSweep(std::max<size_t>(maxBatch, 1), capMs, std::max(threads, 1));
+    return 0;
+  }
+  if (argc > 1 && std::string(argv[1]) == "compact") {
+    int plies = argc > 2 ? std::atoi(argv[2]) : 40;
+    unsigned seed = argc > 3 ? std::atoi(argv[3]) : 0;
+    torch::NoGradGuard no_grad;
+    benchCompaction(plies, seed);
+    return 0;
+  }
+  if (argc > 1 && std::string(argv[1]) == "scaling") {
+    int maxTrees = argc > 2 ? std::atoi(argv[2])
+                            : std::thread::hardware_concurrency();
+    int plies = argc > 3 ? std::atoi(argv[3]) : 4;
+    unsigned seed = argc > 4 ? std::atoi(argv[4]) : 0;
+    torch::NoGradGuard no_grad;
+    benchScaling(std::max(maxTrees, 1), plies, seed);
+    return 0;
+  }
+
+  int plies = argc > 1 ? std::atoi(argv[1]) : 4;
+  unsigned seed = argc > 2 ? std::atoi(argv[2]) : 0;
+  int64_t clockMs = argc > 3 ? std::atoll(argv[3]) : 0;
+  int64_t incrementMs = argc > 4 ? std::atoll(argv[4]) : 0;
+  bool graph = argc > 5 ? std::atoi(argv[5]) != 0 : GRAPH_SEARCH;
+  uint64_t treeMB = argc > 6 ? std::atoll(argv[6]) : TREE_BUDGET_MB;
+
+  if (const char *path = std::getenv("SYZYGY_PATH")) {
+    initTablebases(path);
+  }
+  torch::manual_seed(seed);
+  std::srand(seed);
+  torch::NoGradGuard no_grad;
+  DNN model = DNN();
+  model->to(torch::kCPU);
+
+  std::printf("%-12s %10s %10s %9s %8s | %6s %6s %6s %6s | %8s %8s\n",
+              "position", "nodes/s", "evals/s", "batch", "collide", "select",
+              "encode", "infer", "backup", "nodes", "edges");
+
+  SearchStats total = {};
+  double totalSeconds = 0;
+  std::vector<EncodingResult> encodings;
+  for (const auto &[name, fen] : BENCH_FENS) {
+    GlobalData g = GlobalData(torch::kCPU, nullptr);
+    g.graph = graph;
+    g.treeBudget = treeMB << 20;
+    Node *root = new Node(nullptr, Midnight::SharedPosition(fen));
+    Node *tree = root;
+
+    std::array<Clock, 2> clocks = {Clock{clockMs, incrementMs},
+                                   Clock{clockMs, incrementMs}};
+
+    auto start = std::chrono::steady_clock::now();
+    for (int ply = 0; ply < plies && !isTerminal(root->position); ply++) {
+      Clock &clock = clocks[ply % 2];
+      if (clockMs > 0) {
+        g.limits = timedLimits(clock);
+      }
+      auto moveStart = std::chrono::steady_clock::now();
+      Node *selected = getNextMove(root, model, 1.0f, g);
+      clock.timeMs -= std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::steady_clock::now() - moveStart)
+                          .count();
+      clock.timeMs += clock.incrementMs;
+      // the siblings go, as in a game, so pruning sees the whole graph.
+      root = advanceRoot(root, selected, g);
+    }
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    encodings.push_back(benchEncoding(tree));
+    delete tree;
+
+    printStats(name, g.stats, seconds);
+    total += g.stats;
+    totalSeconds += seconds;
+  }
+
+  printStats("total", total, totalSeconds);
+  std::printf("max rss: %.1f MB\n", maxResidentMB());
+  double searches = total.searches == 0 ? 1 : total.searches;
+  std::printf("early stop: %.1f simulations saved per move\n",
+              total.simulationsSaved / searches);
+  std::printf("tablebases: %d pieces, %lu nn evals avoided, %lu root hits\n",
+              tablebasePieces(), total.tablebaseHits,
+              total.tablebaseRootHits);
+  std::printf("solver: %lu proven wins played\n", total.provenWins);
+  std::printf("%s: %.1f nn evals per move, %lu transpositions\n",
+              graph ? "graph" : "tree", total.nnEvals / searches,
+              total.transpositions);
+  std::printf("tree memory: peak %.1f MB of %lu MB, %lu prunes freed %lu "
+              "nodes\n",
+              total.peakTreeBytes / 1048576.0, treeMB, total.prunes,
+              total.nodesPruned);
+  if (clockMs > 0) {
+    std::printf("timed: %lu moves, mean %.1f ms, max %.1f ms, %lu over "
+                "budget\n",
+                total.searches, total.searchTime / total.searches * 1000,
+                total.maxSearchTime * 1000, total.overruns);
+  }
+
+  std::printf("\n%-12s %10s %10s %9s %s\n", "position", "state us",
+              "fast us", "speedup", "match");
+  for (size_t i = 0; i < encodings.size(); i++) {
+    const EncodingResult &result = encodings[i];
+    std::printf("%-12s %10.1f %10.1f %8.1fx %s\n", BENCH_FENS[i].first.c_str(),
+                result.stateUs, result.fastUs,
+                result.fastUs > 0 ? result.stateUs / result.fastUs : 0,
+                result.match ? "yes" : "NO");
+  }
+
+  return 0;
+}
@@ -7,17 +7,35 @@
 #include <c10/core/Device.h>
 #include <c10/core/DeviceType.h>
 #include <c10/core/TensorOptions.h>
+#include <cassert>
 #include <torch/types.h>
 
-// creates an array of the history boards.
-std::array<Position, HISTORY_BOARDS> constructHistory(Node *node) {
-  std::array<Position, HISTORY_BOARDS> history = {
-      Position(START_FEN), Position(START_FEN), Position(START_FEN),
-      Position(START_FEN)};
+BoardPlanes encodePlanes(const SharedPosition &board, int repetitions) {
+  BoardPlanes planes;
+  for (int color = 0; color < 2; color++) {
+    for (int pieceType = 0; pieceType < 6; pieceType++) {
+      planes[color * 6 + pieceType] = board.pieces[color * 8 + pieceType];
+    }
+  }
+  planes[12] = repetitions >= 1 ? ~0ULL : 0;
+  planes[13] = repetitions >= 2 ? ~0ULL : 0;
+  return planes;
+}
+
+const BoardPlanes &startPlanes() {
+  static const BoardPlanes planes = encodePlanes(SharedPosition(START_FEN), 0);
+  return planes;
+}
+
+// collects the history boards from the node's ancestors.
+AncestorView constructHistory(const Node *node) {
+  AncestorView history = {node, {}};
+  history.boards.fill(&startPlanes());
 
   const Node *current = node;
-  for (int i = 0; i < 4 && current != nullptr; i++) {
-    history[i] = current->position;
+  for (int i = 0; i < HISTORY_BOARDS && current != nullptr; i++) {
+    assert(current->repetitions >= 0);
+    history.boards[i] = &current->planes;
     current = current->parent;
   }
 
@@ -26,62 +44,61 @@ std::array<Position, HISTORY_BOARDS> constructHistory(Node *node) {
 
 // creates the input planes to be put into DNN.
 // possibly need to normalize some of these features
-torch::Tensor createState(const std::array<Position, HISTORY_BOARDS> &boards,
+torch::Tensor createState(const AncestorView &history,
                           const torch::Device &device) {
+  const SharedPosition &board = history.node->position;
+
   // initialize the planes.
   torch::Tensor boardState = torch::zeros({INPUT_PLANES, 8, 8}).to(device, 0);
 
   for (int i = 0; i < HISTORY_BOARDS; i++) {
-    for (int pieceType = 0; pieceType < 6; pieceType++) {
-      for (int color = 0; color < 2; color++) {
-        uint64_t pieceBoard = boards[i].pieces[pieceType + color * 8];
+    for (int plane = 0; plane < 14; plane++) {
+      uint64_t bitboard = (*history.boards[i])[plane];
+
+      // the repetition planes are all or nothing.
+      if (bitboard == ~0ULL) {
+        boardState[i * 14 + plane] = torch::ones({8, 8});
+        continue;
+      }
 
-        // loop to pop every bit from bitboard.
-        while (pieceBoard != 0) {
-          int index = __builtin_ctzll(pieceBoard);
-          boardState[i * 14 + color * 6 + pieceType][index / 8][index % 8] = 1;
+      // loop to pop every bit from bitboard.
+      while (bitboard != 0) {
+        int index = __builtin_ctzll(bitboard);
+        boardState[i * 14 + plane][index / 8][index % 8] = 1;
 
-          pieceBoard ^= 1ULL << index;
-        }
+        bitboard ^= 1ULL << index;
       }
     }
-    // repetition boards.
-    if (boards[i].has_repetition(Position::TWO_FOLD)) {
-      boardState[i * 14 + 12] = torch::ones({8, 8});
-    }
-    if (boards[i].has_repetition(Position::THREE_FOLD)) {
-      boardState[i * 14 + 13] = torch::ones({8, 8});
-    }
   }
 
   // situational boards.
 
   // current turn.
   boardState[14 * HISTORY_BOARDS] =
-      boards[0].turn() == WHITE ? torch::zeros({8, 8}) : torch::ones({8, 8});
+      board.turn() == WHITE ? torch::zeros({8, 8}) : torch::ones({8, 8});
 
   // halfmove count.
   boardState[14 * HISTORY_BOARDS + 1] =
-      torch::full({8, 8}, boards[0].moves() / 100.0f);
+      torch::full({8, 8}, board.moves() / 100.0f);
 
   // castling.
   boardState[14 * HISTORY_BOARDS + 2] =
-      boards[0].king_and_oo_rook_not_moved<WHITE>() ? torch::ones({8, 8})
-                                                    : torch::zeros({8, 8});
+      board.king_and_oo_rook_not_moved<WHITE>() ? torch::ones({8, 8})
+                                               : torch::zeros({8, 8});
   boardState[14 * HISTORY_BOARDS + 3] =
-      boards[0].king_and_ooo_rook_not_moved<WHITE>() ? torch::ones({8, 8})
-                                                     : torch::zeros({8, 8});
+      board.king_and_ooo_rook_not_moved<WHITE>() ? torch::ones({8, 8})
+                                                : torch::zeros({8, 8});
   boardState[14 * HISTORY_BOARDS + 4] =
-      boards[0].king_and_oo_rook_not_moved<BLACK>() ? torch::ones({8, 8})
-                                                    : torch::zeros({8, 8});
+      board.king_and_oo_rook_not_moved<BLACK>() ? torch::ones({8, 8})
+                                               : torch::zeros({8, 8});
   boardState[14 * HISTORY_BOARDS + 5] =
-      boards[0].king_and_ooo_rook_not_moved<BLACK>() ? torch::ones({8, 8})
-                                                     : torch::zeros({8, 8});
+      board.king_and_ooo_rook_not_moved<BLACK>() ? torch::ones({8, 8})
+                                                : torch::zeros({8, 8});
 
   // fifty move rule. fifty_move_rule() returns the move count where there
   // hasn't been a pawn push or capture.
   boardState[14 * HISTORY_BOARDS + 6] =
-      torch::full({8, 8}, boards[0].fifty_move_rule() / 100.0f);
+      torch::full({8, 8}, board.fifty_move_rule() / 100.0f);
 
   return boardState;
 }
\ No newline at end of file
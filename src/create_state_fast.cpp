@@ -1,55 +1,43 @@
 #include "create_state_fast.h"
-#include "arange.cuh"
-#include "batch_and_ne.cuh"
+#include "create_state.h"
 #include "move_gen.h"
-#include "sq.cuh"
+#include "scheduler.h"
+#include <algorithm>
+#include <cassert>
 #include <c10/core/ScalarType.h>
 #include <torch/torch.h>
 #include <vector>
+#ifdef HAS_CUDA
+#include "arange.cuh"
+#include "batch_and_ne.cuh"
+#include "sq.cuh"
+#endif
 
-// creates an array of the history boards.
+// batch entries per scheduler task. one entry is only 63 planes, so smaller
+// chunks cost more in scheduling than they save.
+constexpr int64_t EXPAND_GRAIN = 8;
+
+// copies the cached history planes of every node in the batch.
 NNInputBatch constructHistoryFast(Node** &begin, Node** &end) {
   NNInputBatch input;
   Histories &histories = input.histories;
   std::vector<std::array<float, 7>> &scalars = input.scalars;
+  histories.resize(end - begin);
+  scalars.reserve(end - begin);
 
   for (Node **i = begin; i != end; i++) {
-    Node *node = *i;
-    std::array<uint64_t, HISTORY_BOARDS * 14> history = {0};
-    const Midnight::Position &board = node->position;
-    const Node *current = node;
-
-    auto createBoards = [&](const Midnight::Position &board, const int &i) {
-      for (int color = 0; color < 2; color++) {
-        for (int pieceType = 0; pieceType < 6; pieceType++) {
-          history[i * 14 + color * 6 + pieceType] =
-              board.pieces[color * 8 + pieceType];
-        }
-      }
-      history[i * 14 + 12] =
-          board.has_repetition(Midnight::Position::TWO_FOLD) *
-          0xffffffffffffffff;
-      history[i * 14 + 13] =
-          board.has_repetition(Midnight::Position::THREE_FOLD) *
-          0xffffffffffffffff;
-    };
-
-    for (int i = 0; i < 4; i++) {
-      if (current) {
-        createBoards(current->position, i);
-      } else {
-        for (int j = 0; i + j < 4; j++) {
-          createBoards(START_POS, i + j);
-        }
-        break;
-      }
-      current = current->parent;
+    AncestorView view = constructHistory(*i);
+    std::array<uint64_t, HISTORY_BOARDS * 14> &history =
+        histories[i - begin];
+    for (int j = 0; j < HISTORY_BOARDS; j++) {
+      std::copy(view.boards[j]->begin(), view.boards[j]->end(),
+                history.begin() + j * 14);
     }
 
-    histories.push_back(std::move(history));
+    const Midnight::SharedPosition &board = (*i)->position;
+    // same order as the situational planes in createState.
     scalars.push_back(
-        {board.fifty_move_rule() / 100.0f, board.moves() / 100.0f,
-         static_cast<float>(board.turn()),
+        {static_cast<float>(board.turn()), board.moves() / 100.0f,
          static_cast<float>(
              board.king_and_oo_rook_not_moved<Midnight::WHITE>()),
          static_cast<float>(
@@ -57,17 +45,51 @@ NNInputBatch constructHistoryFast(Node** &begin, Node** &end) {
          static_cast<float>(
              board.king_and_oo_rook_not_moved<Midnight::BLACK>()),
          static_cast<float>(
-             board.king_and_ooo_rook_not_moved<Midnight::BLACK>())});
+             board.king_and_ooo_rook_not_moved<Midnight::BLACK>()),
+         board.fifty_move_rule() / 100.0f});
   }
 
   return input;
 }
 
+void expandPlanes(const NNInputBatch &input, float *planes) {
+  const int64_t B = input.histories.size();
+
+  defaultScheduler().parallelFor(0, B, EXPAND_GRAIN, [&](int64_t begin,
+                                                          int64_t end) {
+    for (int64_t b = begin; b < end; b++) {
+      float *out = planes + b * INPUT_PLANES * 64;
+      const std::array<uint64_t, HISTORY_BOARDS * 14> &history =
+          input.histories[b];
+
+      for (int plane = 0; plane < HISTORY_BOARDS * 14; plane++) {
+        uint64_t bitboard = history[plane];
+        for (int square = 0; square < 64; square++) {
+          out[plane * 64 + square] = (bitboard >> square) & 1;
+        }
+      }
+      for (int scalar = 0; scalar < 7; scalar++) {
+        std::fill_n(out + (HISTORY_BOARDS * 14 + scalar) * 64, 64,
+                    input.scalars[b][scalar]);
+      }
+    }
+  });
+}
+
 torch::Tensor createStateFast(Node** begin, Node** end,
                               const torch::Device device) {
   NNInputBatch input = constructHistoryFast(begin, end);
   const long B = end - begin;
 
+  if (device == torch::kCPU) {
+    torch::Tensor planes =
+        torch::empty({B, INPUT_PLANES, 8, 8},
+                     torch::TensorOptions().dtype(torch::kFloat));
+    expandPlanes(input, planes.data_ptr<float>());
+    return planes;
+  }
+
+#ifdef HAS_CUDA
   torch::Tensor batch =
       torch::from_blob((void *)input.histories.data(), {B, HISTORY_BOARDS * 14},
                        torch::TensorOptions().dtype(torch::kUInt64))
@@ -84,7 +106,7 @@ torch::Tensor createStateFast(Node** begin, Node** end,
 
   arange(64, maskPtr);
   sq(64, maskPtr);
-  batch_and_ne(1, maskPtr, batchPtr, binPlanesPtr);
+  batch_and_ne(B, maskPtr, batchPtr, binPlanesPtr);
   torch::Tensor scalar_vals =
       torch::from_blob(input.scalars.data(), {B, 7},
                        torch::TensorOptions().dtype(torch::kFloat))
@@ -94,4 +116,8 @@ torch::Tensor createStateFast(Node** begin, Node** end,
       scalar_vals.view({B, 7, 1, 1}).expand({B, 7, 8, 8});
 
   return torch::cat({binPlanes, scalar_planes}, 1);
-}
\ No newline at end of file
+#else
+  assert(false && "createStateFast needs a cuda build for cuda devices");
+  return torch::Tensor();
+#endif
+}
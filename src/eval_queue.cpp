@@ -0,0 +1,59 @@
+#include "eval_queue.h"
+#include <algorithm>
+
+void PendingBatch::answer() {
+  // the notify happens under the lock, so the waiter cannot free the batch
+  // before the evaluator is done with it.
+  std::lock_guard<std::mutex> guard(lock);
+  if (--pending == 0) {
+    answered.notify_all();
+  }
+}
+
+void PendingBatch::wait() {
+  std::unique_lock<std::mutex> guard(lock);
+  answered.wait(guard, [&] { return pending == 0; });
+}
+
+void EvalQueue::enqueue(Node *const *nodes, size_t count,
+                        PendingBatch *batch) {
+  batch->value.resize(count);
+  batch->policy.resize(count * POLICY_SIZE);
+  {
+    std::lock_guard<std::mutex> guard(batch->lock);
+    batch->pending = count;
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < count; i++) {
+    leaves.enqueue({nodes[i], batch, static_cast<uint32_t>(i), now});
+  }
+  // the leaves are in the queue before they are counted, so every count the
+  // evaluator takes has a leaf behind it.
+  ready.release(count);
+}
+
+size_t EvalQueue::waitBatch(QueuedLeaf *out, size_t max,
+                            std::chrono::milliseconds idle) {
+  max = std::min(max, batchSize);
+  if (max == 0 || !ready.try_acquire_for(idle)) {
+    return 0;
+  }
+
+  size_t taken = 1;
+  auto deadline = std::chrono::steady_clock::now() + maxWait;
+  while (taken < max && ready.try_acquire()) {
+    taken++;
+  }
+  while (taken < max && ready.try_acquire_until(deadline)) {
+    taken++;
+  }
+
+  // a producer's leaves may not be visible to one bulk dequeue yet even
+  // though they were counted, so keep going until all of them are out.
+  size_t dequeued = 0;
+  while (dequeued < taken) {
+    dequeued += leaves.try_dequeue_bulk(out + dequeued, taken - dequeued);
+  }
+  return taken;
+}
@@ -0,0 +1,179 @@
+#include "concurrent_queue.h"
+#include "eval_queue.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct Settings {
+  int producers = 4;
+  int batchSize = 32;
+  int rounds = 2000;
+  int gatherUs = 50;  // selection time between a game's batches.
+  int forwardUs = 300; // simulated forward pass, spent asleep as on a gpu.
+};
+
+struct Result {
+  std::vector<double> latencies; // microseconds from queued to scored.
+  uint64_t forwardPasses = 0;
+  double evaluatorCpu = 0; // seconds the evaluator thread was on a core.
+};
+
+static double threadCpuSeconds() {
+  timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// scores one batch: sleeps for the forward pass, then answers the leaves.
+static void forward(QueuedLeaf *batch, size_t size, const Settings &s,
+                    Result &result) {
+  std::this_thread::sleep_for(std::chrono::microseconds(s.forwardUs));
+  auto now = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < size; i++) {
+    result.latencies.push_back(
+        std::chrono::duration<double, std::micro>(now - batch[i].queued)
+            .count());
+    batch[i].batch->answer();
+  }
+  result.forwardPasses += 1;
+}
+
+template <typename Enqueue, typename Evaluate>
+static Result run(const Settings &s, Enqueue enqueue, Evaluate evaluate) {
+  // each producer stands in for one game thread: it queues batchSize
+  // leaves, waits until the evaluator has answered all of them, then spends
+  // gather microseconds selecting the next batch.
+  std::vector<PendingBatch> producers(s.producers);
+  std::atomic<int> running = s.producers;
+  Result result;
+
+  std::thread evaluator([&] {
+    double start = threadCpuSeconds();
+    while (running.load() > 0) {
+      evaluate(result);
+    }
+    result.evaluatorCpu = threadCpuSeconds() - start;
+  });
+
+  std::vector<std::thread> threads;
+  for (PendingBatch &producer : producers) {
+    threads.emplace_back([&] {
+      std::vector<Node *> leaves(s.batchSize, nullptr);
+      for (int round = 0; round < s.rounds; round++) {
+        enqueue(leaves.data(), leaves.size(), &producer);
+        producer.wait();
+        std::this_thread::sleep_for(std::chrono::microseconds(s.gatherUs));
+      }
+      running.fetch_sub(1);
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  evaluator.join();
+  return result;
+}
+
+// the previous hand-off: take whatever size_approx reports, return at once
+// if that is nothing, and sleep 10us between calls.
+static Result runPolling(const Settings &s) {
+  moodycamel::ConcurrentQueue<QueuedLeaf> q;
+  auto enqueue = [&](Node *const *nodes, size_t count, PendingBatch *batch) {
+    {
+      std::lock_guard<std::mutex> guard(batch->lock);
+      batch->pending = count;
+    }
+    auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) {
+      q.enqueue({nodes[i], batch, static_cast<uint32_t>(i), now});
+    }
+  };
+  auto evaluate = [&](Result &result) {
+    QueuedLeaf batch[512];
+    size_t size = std::min<size_t>(q.size_approx(), std::size(batch));
+    if (size > 0) {
+      size = q.try_dequeue_bulk(batch, size);
+      if (size > 0) {
+        forward(batch, size, s, result);
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::nanoseconds(10000));
+  };
+  return run(s, enqueue, evaluate);
+}
+
+static Result runBlocking(const Settings &s, int maxWaitUs) {
+  EvalQueue q(s.producers * s.batchSize, std::chrono::microseconds(maxWaitUs));
+  auto enqueue = [&](Node *const *nodes, size_t count, PendingBatch *batch) {
+    q.enqueue(nodes, count, batch);
+  };
+  auto evaluate = [&](Result &result) {
+    QueuedLeaf batch[512];
+    size_t size =
+        q.waitBatch(batch, std::size(batch), std::chrono::milliseconds(10));
+    if (size > 0) {
+      forward(batch, size, s, result);
+    }
+  };
+  return run(s, enqueue, evaluate);
+}
+
+static double percentile(std::vector<double> &values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  size_t i = std::min(values.size() - 1,
+                      static_cast<size_t>(p * values.size()));
+  std::nth_element(values.begin(), values.begin() + i, values.end());
+  return values[i];
+}
+
+static void print(const char *name, Result result) {
+  uint64_t leaves = result.latencies.size();
+  std::printf("%-16s %9.1f %9.1f %8.1f %10.3f\n", name,
+              percentile(result.latencies, 0.5),
+              percentile(result.latencies, 0.99),
+              static_cast<double>(leaves) /
+                  std::max<uint64_t>(result.forwardPasses, 1),
+              result.evaluatorCpu);
+}
+
+// compares the sleep-poll evaluator loop with the blocking EvalQueue on
+// simulated game threads and forward passes: per-leaf latency from queued
+// to scored, leaves per forward pass and the evaluator thread's cpu time.
+// usage: eval_queue_bench [producers] [rounds] [forward us] [gather us]
+int main(int argc, char **argv) {
+  Settings s;
+  if (argc > 1) {
+    s.producers = std::atoi(argv[1]);
+  }
+  if (argc > 2) {
+    s.rounds = std::atoi(argv[2]);
+  }
+  if (argc > 3) {
+    s.forwardUs = std::atoi(argv[3]);
+  }
+  if (argc > 4) {
+    s.gatherUs = std::atoi(argv[4]);
+  }
+
+  std::printf("%d producers of %d leaves, %d rounds, %d us forward, "
+              "%d us gather\n",
+              s.producers, s.batchSize, s.rounds, s.forwardUs, s.gatherUs);
+  std::printf("%-16s %9s %9s %8s %10s\n", "hand-off", "p50 us", "p99 us",
+              "batch", "cpu s");
+  print("sleep-poll", runPolling(s));
+  for (int maxWaitUs : {0, 100, 500}) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "blocking %dus", maxWaitUs);
+    print(name, runBlocking(s, maxWaitUs));
+  }
+  return 0;
+}
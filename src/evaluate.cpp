@@ -2,40 +2,59 @@
 #include "constants.h"
 #include "create_state_fast.h"
 #include "dnn.h"
+#include "instrument.h"
 #include "mcts.h"
 #include "node.h"
 #include <algorithm>
 #include <c10/core/DeviceType.h>
-#include <concurrent_queue.h>
+#include <chrono>
 #include <iterator>
 
-void evaluate(ConcurrentQueue<Node *> &q, DNN &model,
-              std::array<GlobalData *, PARALLEL_GAMES> &g) {
-  Node* batch[512];
-  int sizeApprox = std::min(q.size_approx(), 512UL);
-  if (sizeApprox == 0) {
+// how long the evaluator sleeps without leaves before it returns.
+constexpr std::chrono::milliseconds IDLE_WAIT(10);
+
+void evaluate(EvalQueue &q, DNN &model) {
+  QueuedLeaf leaves[MAX_BATCH_SIZE];
+  size_t size = q.waitBatch(leaves, std::size(leaves), IDLE_WAIT);
+  if (size == 0) {
     return;
   }
-  q.try_dequeue_bulk(std::begin(batch), sizeApprox);
+  INSTRUMENT_TIMER(EVALUATE);
 
-  std::cout << std::end(batch) << std::endl;
+  Node* batch[MAX_BATCH_SIZE];
+  for (size_t i = 0; i < size; i++) {
+    batch[i] = leaves[i].node;
+  }
   // #if HAS_CUDA
   auto begin = std::begin(batch);
-  auto end = std::begin(batch) + sizeApprox;
+  auto end = std::begin(batch) + size;
 
   torch::Tensor state = createStateFast(begin, end, torch::kCUDA);
-  Eval outputs = model->forward(state);
-  
-  for (Node *node = *begin; node != *end; node++) {
-    GlobalData* data = g[node->threadIndex];
-    data->batch.nodes.push_back(node);
-    data->simulation += 1;
-  }
+  INSTRUMENT_COUNT(NN_EVALS, size);
+  INSTRUMENT_RECORD(BATCH_SIZE, size);
+  Eval outputs = [&] {
+    INSTRUMENT_LATENCY(INFERENCE, INFERENCE_LATENCY_US);
+    return model->forward(state);
+  }();
+
+  torch::Tensor value = outputs.value.to(torch::kCPU).contiguous();
+  torch::Tensor policy = outputs.policy.to(torch::kCPU).contiguous();
+  const float *valuePtr = value.data_ptr<float>();
+  const float *policyPtr = policy.data_ptr<float>();
 
-  for (GlobalData* data : g) {
-    putBatch(nullptr, outputs, *data);
-    data->simulation += data->batch.nodes.size();
-    data->batch.nodes = {};
+  // row i of the forward pass goes to the leaf's own row in its game's
+  // batch. the game threads back their batches up once all are answered.
+  auto scored = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < size; i++) {
+    PendingBatch *pending = leaves[i].batch;
+    pending->value[leaves[i].row] = valuePtr[i];
+    std::copy_n(policyPtr + i * POLICY_SIZE, POLICY_SIZE,
+                pending->policy.data() + leaves[i].row * POLICY_SIZE);
+    INSTRUMENT_RECORD(LEAF_LATENCY_US,
+                      std::chrono::duration_cast<std::chrono::microseconds>(
+                          scored - leaves[i].queued)
+                          .count());
+    pending->answer();
   }
   // #endif
 }
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "dnn.h"
+#include <cstddef>
+#include <vector>
+
+// forward passes timed per batch size, after WARMUP_PASSES untimed ones.
+constexpr int TIMED_PASSES = 20;
+constexpr int WARMUP_PASSES = 3;
+
+// forward pass latency and throughput at one batch size.
+struct BatchTiming {
+  size_t batchSize;
+  double p50Ms;
+  double p99Ms;
+  // batchSize over the mean latency, times the passes run at once.
+  double positionsPerSecond;
+};
+
+// the powers of two from 1 up to maxBatch, and maxBatch itself.
+std::vector<size_t> batchSizes(size_t maxBatch);
+
+// times model->forward on random input of each size on device, with
+// concurrency threads running passes at once as that many games would.
+std::vector<BatchTiming> sweepBatchSizes(DNN &model,
+                                         const torch::Device &device,
+                                         const std::vector<size_t> &sizes,
+                                         int concurrency = 1);
+
+// the size with the most positions per second whose p99 latency is within
+// capMs, or the first size if none is.
+size_t chooseBatchSize(const std::vector<BatchTiming> &timings, double capMs);
+
+// sweeps up to MAX_BATCH_SIZE with concurrency passes at once and chooses
+// under BATCH_LATENCY_CAP_MS.
+size_t tuneBatchSize(DNN &model, const torch::Device &device,
+                     int concurrency = 1);
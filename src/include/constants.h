@@ -8,13 +8,41 @@ constexpr int INPUT_PLANES =
     HISTORY_BOARDS * 14 +
     7; // (6 white pieces + 6 black pieces + 2 repetitions) per history board. 7
        // situational planes.
+constexpr int POLICY_SIZE =
+    64 * 73; // 73 move planes per from square, see policy_index.h.
 constexpr int TRUNK_CHANNELS = 64; // channels per resnet block.
 constexpr int TOWER_SIZE = 6;      // amount of resnet blocks.
 constexpr float C_PUCT = 1.5f;     // PUCT constant for MCTS selection.
 constexpr int SIMULATIONS = 200;   // amount of simulations for one move.
+constexpr int FAST_SIMULATIONS =
+    50; // simulations of a self-play move that is not recorded for training.
+constexpr double FULL_SEARCH_PROBABILITY =
+    0.25; // share of self-play moves that get a full, recorded search.
+constexpr int BATCH_SIZE = 32;     // max leaves gathered per search batch.
+constexpr int MAX_BATCH_SIZE = 512; // max leaves per forward pass.
+constexpr double MAX_BATCH_SHARE =
+    0.25; // largest share of a move's simulations one batch may gather.
+constexpr bool AUTOTUNE_BATCH =
+    true; // replace BATCH_SIZE with a size timed on this machine at startup.
+constexpr double BATCH_LATENCY_CAP_MS =
+    20; // slowest forward pass (p99) the tuned batch size may take.
+constexpr int EVAL_MAX_WAIT_US =
+    100; // how long the gpu evaluator waits to fill a batch after a leaf.
+constexpr int COLLISION_BUDGET =
+    8; // descents per batch that may hit an already batched leaf.
+constexpr bool GRAPH_SEARCH =
+    false; // share transposed positions between parents during search.
+constexpr uint64_t TREE_BUDGET_MB = 1024; // memory a game's tree may use.
+constexpr bool COMPACT_TREE =
+    true; // relocate the kept subtree into one block after every move.
+constexpr double PRUNE_START = 0.9; // budget share that triggers pruning.
+constexpr double PRUNE_TARGET =
+    0.75; // budget share that pruning brings the tree back to.
+constexpr double PRUNE_BACKOFF =
+    0.05; // budget share to grow by before retrying a prune that fell short.
 constexpr float FPU = -0.2f;       // temperature constant for move selection.
 constexpr uint64_t TABLE_SIZE = 1ULL << 25; // size of transposition table.
-constexpr float UNKNOWN = INFINITY;         // unknown value for batchPUCT.
+constexpr float UNKNOWN = INFINITY;         // value of a leaf not yet evaluated.
 constexpr float VL = 2; // virtual loss value for updating statistics.
 constexpr float TEMPERATURE_DECAY = -0.42f; // the exponent for temperature.
 constexpr int PARALLEL_GAMES =
@@ -8,6 +8,21 @@
 
 using namespace Midnight;
 
-std::array<Position, HISTORY_BOARDS> constructHistory(Node *node);
-torch::Tensor createState(const std::array<Position, HISTORY_BOARDS> &boards,
-                          const torch::Device &device);
\ No newline at end of file
+// encodes a board's piece bitboards and repetition planes.
+BoardPlanes encodePlanes(const SharedPosition &board, int repetitions);
+
+// the planes of the start position, used for history before the game began.
+const BoardPlanes &startPlanes();
+
+// the boards fed to the network, newest first, as pointers to the cached
+// planes of the node and its ancestors. nothing is copied.
+struct AncestorView {
+  const Node *node;
+  std::array<const BoardPlanes *, HISTORY_BOARDS> boards;
+};
+
+// every node on the path must already have its planes encoded, which
+// gatherLeaf does on the first visit.
+AncestorView constructHistory(const Node *node);
+torch::Tensor createState(const AncestorView &history,
+                          const torch::Device &device);
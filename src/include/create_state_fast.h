@@ -1,10 +1,11 @@
+#pragma once
+
 #include "node.h"
 #include "move_gen.h"
 #include "constants.h"
 #include <torch/torch.h>
 #include <vector>
 
-const Midnight::Position START_POS = Midnight::Position(Midnight::START_FEN);
 typedef std::vector<std::array<uint64_t, HISTORY_BOARDS * 14>> Histories;
 
 struct NNInputBatch {
@@ -13,5 +14,12 @@ struct NNInputBatch {
 };
 
 NNInputBatch constructHistoryFast(Node** &begin, Node** &end);
+
+// expands the bitboard histories into [B, INPUT_PLANES, 8, 8] floats on the
+// cpu, split over the batch between the scheduler's workers.
+void expandPlanes(const NNInputBatch &input, float *planes);
+
+// the same planes as stacking createState over the batch. cpu devices use
+// expandPlanes, cuda devices use the kernels in the .cu files.
 torch::Tensor createStateFast(Node** begin, Node** end,
-                              const torch::Device device);
\ No newline at end of file
+                              const torch::Device device);
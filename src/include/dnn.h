@@ -123,7 +123,7 @@ private:
 public:
   PolicyHeadImpl()
       : conv(ConvBlock(TRUNK_CHANNELS, 2, 1, 0)), flatten(torch::nn::Flatten()),
-        fc(torch::nn::Linear(128, 4672)) {
+        fc(torch::nn::Linear(128, POLICY_SIZE)) {
     register_module("conv", conv);
     register_module("flatten", flatten);
     register_module("fc", fc);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "concurrent_queue.h"
+#include "constants.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <semaphore>
+#include <vector>
+
+struct Node;
+
+// one game's leaves out at the evaluator thread. the evaluator writes each
+// leaf's network outputs to the leaf's row and answers it; the game thread
+// waits for every answer and then backs its batch up itself, so the
+// batch's visits never leave the game thread.
+struct PendingBatch {
+  std::vector<float> value;  // one per leaf.
+  std::vector<float> policy; // POLICY_SIZE per leaf.
+  uint32_t pending = 0;      // leaves not yet answered.
+  std::mutex lock;
+  std::condition_variable answered;
+
+  // called by the evaluator once a leaf's row is written.
+  void answer();
+  // blocks until every leaf is answered.
+  void wait();
+};
+
+// a leaf waiting for the evaluator thread, the row of its batch that takes
+// its outputs and the time it was queued, so the evaluator can measure how
+// long it waited.
+struct QueuedLeaf {
+  Node *node;
+  PendingBatch *batch;
+  uint32_t row;
+  std::chrono::steady_clock::time_point queued;
+};
+
+// hands leaves from the game threads to the evaluator thread. every queued
+// leaf releases one semaphore count, so the evaluator sleeps in the kernel
+// until a leaf arrives instead of polling, then keeps collecting until it
+// has batchSize leaves or maxWait has passed since the first one.
+class EvalQueue {
+private:
+  moodycamel::ConcurrentQueue<QueuedLeaf> leaves;
+  std::counting_semaphore<> ready{0};
+  size_t batchSize;
+  std::chrono::microseconds maxWait;
+
+public:
+  EvalQueue(size_t _batchSize, std::chrono::microseconds _maxWait)
+      : batchSize(_batchSize), maxWait(_maxWait) {}
+
+  // sizes batch for count leaves and queues them.
+  void enqueue(Node *const *nodes, size_t count, PendingBatch *batch);
+
+  // fills out with at most min(max, batchSize) leaves and returns how many.
+  // returns 0 if no leaf arrived within idle, so the caller can check
+  // whether it should stop.
+  size_t waitBatch(QueuedLeaf *out, size_t max,
+                   std::chrono::milliseconds idle);
+};
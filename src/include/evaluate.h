@@ -1,8 +1,9 @@
 #include "dnn.h"
 #include "mcts.h"
 #include "node.h"
-#include "concurrent_queue.h"
+#include "eval_queue.h"
 
-using namespace moodycamel;
-
-void evaluate(ConcurrentQueue<Node*> &data, DNN &model, std::array<GlobalData *, PARALLEL_GAMES> &g);
\ No newline at end of file
+// waits for the next batch of leaves on q, evaluates it on the gpu and
+// answers every leaf's game. returns without evaluating if no leaf arrives
+// within a few milliseconds.
+void evaluate(EvalQueue &q, DNN &model);
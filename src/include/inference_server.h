@@ -0,0 +1,19 @@
+#pragma once
+
+#include "dnn.h"
+#include "shared_ring.h"
+#include <cstdint>
+
+struct ServerStats {
+  uint64_t forwardPasses = 0;
+  uint64_t positions = 0;
+  double inferenceTime = 0; // seconds.
+};
+
+// answers the requests of ring's clients until every client has detached
+// or its process has exited.
+// each forward pass takes every request waiting at the time, across all
+// clients. a lone request is read from its slot without a copy. the
+// ring's heartbeat is stamped around every pass and idle wait.
+ServerStats serveInference(SharedRing &ring, DNN &model,
+                           const torch::Device &device);
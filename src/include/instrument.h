@@ -0,0 +1,88 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// low overhead counters, timers and histograms for the search hot path.
+// every thread writes to its own slots; readers sum all threads without
+// taking locks. the INSTRUMENT_* macros compile to nothing unless the build
+// defines INSTRUMENT (cmake -DINSTRUMENT=ON).
+namespace instrument {
+
+enum Counter {
+  SIMULATIONS,    // descents from the root.
+  NN_EVALS,       // leaves sent to the network.
+  COLLISIONS,     // descents that reached a leaf already in the batch.
+  LOCK_ACQUIRES,  // childLock acquisitions.
+  LOCK_SPINS,     // failed childLock try_lock calls.
+  TABLEBASE_HITS, // leaves scored by the tablebases.
+  COUNTER_COUNT
+};
+
+enum Timer {
+  GET_NEXT_MOVE,
+  GET_BATCH,
+  PUT_BATCH,
+  EVALUATE,
+  INFERENCE, // forward passes.
+  TIMER_COUNT
+};
+
+enum Histogram {
+  SELECTION_DEPTH,      // plies from the root to the selected leaf.
+  BATCH_SIZE,           // leaves per forward pass.
+  INFERENCE_LATENCY_US, // microseconds per forward pass.
+  LEAF_LATENCY_US,      // microseconds from queueing a leaf to its value.
+  HISTOGRAM_COUNT
+};
+
+void count(Counter counter, uint64_t n = 1);
+void record(Histogram histogram, uint64_t value);
+
+// reads the timestamp counter on x86 and falls back to the steady clock
+// elsewhere. the ticks are converted to seconds when dumped.
+uint64_t ticks();
+
+// adds the ticks spent in its scope to a timer, and optionally records the
+// latency in microseconds to a histogram.
+class ScopedTimer {
+private:
+  Timer timer;
+  Histogram histogram;
+  uint64_t start;
+
+public:
+  explicit ScopedTimer(Timer _timer, Histogram _histogram = HISTOGRAM_COUNT);
+  ~ScopedTimer();
+};
+
+// writes the totals over all threads as a json object.
+void dumpJson(std::ostream &os);
+
+// rewrites path with dumpJson every period from a background thread.
+void startDumping(const std::string &path, std::chrono::seconds period);
+void stopDumping();
+
+} // namespace instrument
+
+#define INSTRUMENT_CONCAT_(a, b) a##b
+#define INSTRUMENT_CONCAT(a, b) INSTRUMENT_CONCAT_(a, b)
+
+#ifdef INSTRUMENT
+#define INSTRUMENT_COUNT(counter, n) instrument::count(instrument::counter, n)
+#define INSTRUMENT_RECORD(histogram, value)                                    \
+  instrument::record(instrument::histogram, value)
+#define INSTRUMENT_TIMER(timer)                                                \
+  instrument::ScopedTimer INSTRUMENT_CONCAT(instrumentTimer, __LINE__)(        \
+      instrument::timer)
+#define INSTRUMENT_LATENCY(timer, histogram)                                   \
+  instrument::ScopedTimer INSTRUMENT_CONCAT(instrumentTimer, __LINE__)(        \
+      instrument::timer, instrument::histogram)
+#else
+#define INSTRUMENT_COUNT(counter, n) ((void)(n))
+#define INSTRUMENT_RECORD(histogram, value) ((void)(value))
+#define INSTRUMENT_TIMER(timer) ((void)0)
+#define INSTRUMENT_LATENCY(timer, histogram) ((void)0)
+#endif
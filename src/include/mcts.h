@@ -1,28 +1,170 @@
 #pragma once
 
-#include "concurrent_queue.h"
+#include "constants.h"
 #include "dnn.h"
+#include "eval_queue.h"
 #include "move_gen.h"
 #include "node.h"
+#include "repetition.h"
+#include "shared_ring.h"
+#include "time_manager.h"
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstdint>
+#include <optional>
+#include <unordered_map>
+
+// one descent of the current batch. multiplicity counts the descents that
+// ended at the same leaf, and value is set when the leaf is proven.
+struct Visit {
+  std::vector<Node *> path; // root first.
+  uint32_t multiplicity = 1;
+  float value = UNKNOWN;
+};
 
 struct Batch {
-  std::vector<torch::Tensor> nnInputs;
-  std::vector<Node *> nodes;
+  std::vector<Node *> nodes; // distinct leaves for the network.
+  std::vector<Visit> visits; // every distinct leaf, proven ones included.
+};
+
+// throughput and timing counters accumulated by getNextMove. times are in
+// seconds.
+struct SearchStats {
+  uint64_t searches = 0;          // getNextMove calls.
+  uint64_t simulations = 0;       // descents from the root.
+  uint64_t nnEvals = 0;           // leaves sent to the network.
+  uint64_t batches = 0;           // forward passes.
+  uint64_t collisions = 0;        // descents that hit a leaf already batched.
+  uint64_t edges = 0;             // moves stored on expanded nodes.
+  uint64_t nodesAllocated = 0;    // child nodes created by selection.
+  uint64_t overruns = 0;          // timed searches that ran past their budget.
+  uint64_t simulationsSaved = 0;  // budget left when a search stopped early.
+  uint64_t tablebaseHits = 0;     // leaves scored by tablebases, not the NN.
+  uint64_t tablebaseRootHits = 0; // moves played from the tablebases.
+  uint64_t provenWins = 0;        // moves played from a proven win.
+  uint64_t transpositions = 0;    // edges linked to an existing node.
+  uint64_t prunes = 0;            // times the tree hit its memory budget.
+  uint64_t nodesPruned = 0;       // nodes freed by pruning.
+  uint64_t peakTreeBytes = 0;     // largest tree, sampled between batches.
+  uint64_t nodesCompacted = 0;    // nodes relocated after re-rooting.
+  double selectionTime = 0;
+  double encodingTime = 0;
+  double inferenceTime = 0;
+  double backupTime = 0;
+  double compactionTime = 0; // in advanceRoot, outside getNextMove.
+  double searchTime = 0;    // wall time in getNextMove.
+  double maxSearchTime = 0; // slowest single move.
+
+  SearchStats &operator+=(const SearchStats &other) {
+    searches += other.searches;
+    simulations += other.simulations;
+    nnEvals += other.nnEvals;
+    batches += other.batches;
+    collisions += other.collisions;
+    edges += other.edges;
+    nodesAllocated += other.nodesAllocated;
+    overruns += other.overruns;
+    simulationsSaved += other.simulationsSaved;
+    tablebaseHits += other.tablebaseHits;
+    tablebaseRootHits += other.tablebaseRootHits;
+    provenWins += other.provenWins;
+    transpositions += other.transpositions;
+    prunes += other.prunes;
+    nodesPruned += other.nodesPruned;
+    peakTreeBytes = std::max(peakTreeBytes, other.peakTreeBytes);
+    nodesCompacted += other.nodesCompacted;
+    compactionTime += other.compactionTime;
+    selectionTime += other.selectionTime;
+    encodingTime += other.encodingTime;
+    inferenceTime += other.inferenceTime;
+    backupTime += other.backupTime;
+    searchTime += other.searchTime;
+    maxSearchTime = std::max(maxSearchTime, other.maxSearchTime);
+    return *this;
+  }
 };
 
 struct GlobalData {
-  uint16_t simulation = 0;
+  uint32_t simulation = 0;
+  SearchLimits limits = {}; // when getNextMove stops, set before each move.
   uint32_t currBatchNum = 0;
   Batch batch = {};
   torch::Device device = torch::kCPU;
-  moodycamel::ConcurrentQueue<Node*> *q;
+  EvalQueue *q;
+  SearchStats stats = {};
+  RepetitionTracker repetitions;
+  std::chrono::steady_clock::time_point searchStart;
+  uint64_t searchBatches = 0; // batches gathered by the current search.
+  // the root's move from the tablebases, when the current search skips.
+  std::optional<Midnight::Move> tablebaseMove;
+  // graph search shares a node between every parent that reaches the same
+  // position with the same repetition count. transpositions maps those
+  // keys to the nodes below the root.
+  bool graph = GRAPH_SEARCH;
+  std::unordered_map<uint64_t, Node *> transpositions;
+  // heap memory of the nodes and edges this search allocated and has not
+  // freed, and the most it may reach before pruneTree runs.
+  uint64_t treeBytes = 0;
+  uint64_t treeBudget = TREE_BUDGET_MB << 20;
+  // the size the tree must pass before pruning again, after a prune that
+  // could not reach its target.
+  uint64_t pruneFloor = 0;
+  bool compact = COMPACT_TREE; // whether advanceRoot compacts the tree.
+  size_t batchSize = BATCH_SIZE; // max leaves gathered per batch.
+  // the inference server's ring when the network runs in another process.
+  // batchSize must then be at most RING_LEAVES.
+  RingClient *remote = nullptr;
 
   GlobalData() = default;
-  GlobalData(const torch::Device &_device, moodycamel::ConcurrentQueue<Node*>* _q) : device(_device), q(_q) {};
+  GlobalData(const torch::Device &_device, EvalQueue *_q) : device(_device), q(_q) {};
 };
 
-void putBatch(Node *node, Eval &outputs, GlobalData &g);
+void putBatch(Eval &outputs, GlobalData &g);
+
+// searches node and returns the selected child, or nullptr if g.remote lost
+// its inference server mid search.
 Node *getNextMove(Node *node, DNN &model, float temperature, GlobalData &g);
-bool isTerminal(Midnight::Position &board);
\ No newline at end of file
+
+// root-parallel search: one independent tree per model, each on its own
+// thread with its own batches, all searching node's position with g's
+// limits. node is the first tree; the other trees' root visit counts are
+// added to its edges before the move is chosen, so the training policy
+// also sees every tree.
+Node *getNextMoveRootParallel(Node *node, std::vector<DNN> &models,
+                              float temperature, GlobalData &g);
+
+// frees the least visited subtrees below root's children until the tree is
+// back under PRUNE_TARGET of its budget. the pruned edges keep their visits
+// so their parents' stats stay consistent. searchDone calls it once the
+// tree passes PRUNE_START and g.pruneFloor, between batches when no leaves
+// are in flight. root must be its parent's only live child, as advanceRoot
+// leaves it, since only its subtree is searched for edges into freed nodes.
+void pruneTree(Node *root, GlobalData &g);
+
+// makes selected, a child of root, the next search root and frees what it
+// can no longer reach. root keeps only its edge to selected, so the game
+// path stays available as history. with g.compact the kept subtree is
+// relocated, so the returned root replaces selected.
+Node *advanceRoot(Node *root, Node *selected, GlobalData &g);
+
+// the steps of getNextMove, for drivers that run the network themselves
+// between gathering and backing up a batch:
+//   startSearch(node, g);
+//   while (!searchDone(node, g)) {
+//     if (gatherBatch(node, g)) {
+//       ... evaluate encodeBatch(g), then backupBatch(outputs, g) ...
+//     }
+//   }
+//   selected = finishSearch(node, temperature, g);
+void startSearch(Node *node, GlobalData &g);
+bool searchDone(Node *node, GlobalData &g);
+// returns false when the batch held only terminal leaves and was already
+// backed up.
+bool gatherBatch(Node *node, GlobalData &g);
+torch::Tensor encodeBatch(GlobalData &g);
+void backupBatch(Eval &outputs, GlobalData &g);
+Node *finishSearch(Node *node, float temperature, GlobalData &g);
+bool isTerminal(Midnight::SharedPosition &board);
+// the value of a terminal position for the side to move.
+float terminalValue(Midnight::SharedPosition &board);
\ No newline at end of file
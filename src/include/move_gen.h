@@ -6,8 +6,10 @@
 #include <bitset>
 #include <cassert>
 #include <cstdint>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 namespace Midnight {
@@ -1592,10 +1594,10 @@ inline std::ostream &operator<<(std::ostream &os, const Move &m) {
 
 /* ------------------------ DEFINE POSITION TYPE ------------------------ */
 
-class Position;
+template <typename StateHistory> class BasicPosition;
 
 class PositionState {
-  friend Position;
+  template <typename StateHistory> friend class BasicPosition;
 
 private:
   static constexpr Bitboard WHITE_OO_BANNED_MASK = 0x90;
@@ -1618,15 +1620,70 @@ public:
   ~PositionState() = default;
 };
 
-class Position {
+/* ------------------------ DEFINE STATE HISTORIES ------------------------ */
+
+// Fixed capacity history stored inline. Copying a position copies all of it,
+// which suits make/unmake search on a single board.
+constexpr usize POSITION_STATE_SIZE = 1000;
+using StateStack = Stack<PositionState, POSITION_STATE_SIZE>;
+
+// History whose earlier states are immutable links shared between copies.
+// Copying it copies the current state and one pointer, so a child position
+// shares its parent's history instead of duplicating it.
+class SharedStateHistory {
+public:
+  struct Link {
+    PositionState state;
+    std::shared_ptr<const Link> previous;
+  };
+
+private:
+  PositionState current{};
+  std::shared_ptr<const Link> previous_{};
+  usize length = 0;
+
+public:
+  inline void push(const PositionState &element) {
+    if (length > 0)
+      previous_ = std::make_shared<const Link>(Link{current, previous_});
+    current = element;
+    length++;
+  }
+
+  inline PositionState pop() {
+    PositionState popped = current;
+    if (previous_) {
+      current = previous_->state;
+      previous_ = previous_->previous;
+    }
+    length--;
+    return popped;
+  }
+
+  [[nodiscard]] inline PositionState peek() const { return current; }
+  [[nodiscard]] inline PositionState &top() { return current; }
+
+  inline void clear() {
+    previous_.reset();
+    current = {};
+    length = 0;
+  }
+
+  [[nodiscard]] inline auto size() const { return length; }
+
+  [[nodiscard]] inline auto empty() const { return length == 0; }
+
+  // The state one ply before the current one, or null.
+  [[nodiscard]] inline const Link *previous() const { return previous_.get(); }
+};
+
+template <typename StateHistory> class BasicPosition {
 private:
   Color side = WHITE;
 
   array<Piece, NSQUARES> board{};
 
-  static constexpr i16 POSITION_STATE_SIZE = 1000;
-
-  Stack<PositionState, POSITION_STATE_SIZE> state_history{};
+  StateHistory state_history{};
 
   static constexpr bool ENABLE_HASH_UPDATE = true;
   static constexpr bool DISABLE_HASH_UPDATE = false;
@@ -1644,8 +1701,8 @@ private:
 
 public:
   array<Bitboard, NPIECES> pieces{};
-  Position() = default;
-  explicit Position(const std::string &fen);
+  BasicPosition() = default;
+  explicit BasicPosition(const std::string &fen);
 
   [[nodiscard]] inline u16 fifty_move_rule() const {
     return state_history.peek().fifty_move_rule;
@@ -1737,7 +1794,9 @@ public:
 
   inline void set_fen(const std::string &fen);
   [[nodiscard]] inline std::string fen() const;
-  inline friend std::ostream &operator<<(std::ostream &os, const Position &p);
+  template <typename History>
+  friend std::ostream &operator<<(std::ostream &os,
+                                  const BasicPosition<History> &p);
 
   template <Color color> inline void play(Move move);
 
@@ -1748,9 +1807,18 @@ public:
   template <Color color> inline void undo_null();
 };
 
-inline Position::Position(const std::string &fen) { set_fen(fen); }
+// Position with an inline history, for make/unmake on one board.
+using Position = BasicPosition<StateStack>;
+// Position that is cheap to copy, for storing one per search tree node.
+using SharedPosition = BasicPosition<SharedStateHistory>;
 
-inline void Position::reset() {
+template <typename StateHistory>
+inline BasicPosition<StateHistory>::BasicPosition(const std::string &fen) {
+  set_fen(fen);
+}
+
+template <typename StateHistory>
+inline void BasicPosition<StateHistory>::reset() {
   state_history.clear();
 
   pieces.fill(0);
@@ -1759,8 +1827,10 @@ inline void Position::reset() {
   side = WHITE;
 }
 
+template <typename StateHistory>
 template <bool update_hash>
-inline void Position::place_piece(Piece piece, Square square) {
+inline void BasicPosition<StateHistory>::place_piece(Piece piece,
+                                                     Square square) {
   pieces[piece] |= square_to_bitboard(square);
   board[square] = piece;
   if constexpr (update_hash) {
@@ -1768,7 +1838,9 @@ inline void Position::place_piece(Piece piece, Square square) {
   }
 }
 
-template <bool update_hash> inline void Position::remove_piece(Square square) {
+template <typename StateHistory>
+template <bool update_hash>
+inline void BasicPosition<StateHistory>::remove_piece(Square square) {
   if constexpr (update_hash) {
     state_history.top().hash ^= ZOBRIST_PIECE_SQUARE[piece_at(square)][square];
   }
@@ -1776,14 +1848,16 @@ template <bool update_hash> inline void Position::remove_piece(Square square) {
   board[square] = NO_PIECE;
 }
 
+template <typename StateHistory>
 template <bool update_hash>
-inline void Position::move_piece(Square from, Square to) {
+inline void BasicPosition<StateHistory>::move_piece(Square from, Square to) {
   Piece piece = piece_at(from);
   remove_piece<update_hash>(from);
   place_piece<update_hash>(piece, to);
 }
 
-inline u8 Position::castling_state(Bitboard from_to) const {
+template <typename StateHistory>
+inline u8 BasicPosition<StateHistory>::castling_state(Bitboard from_to) const {
   i32 white_oo = !(from_to & PositionState::WHITE_OO_BANNED_MASK) << 3;
   i32 white_ooo = !(from_to & PositionState::WHITE_OOO_BANNED_MASK) << 2;
   i32 black_oo = !(from_to & PositionState::BLACK_OO_BANNED_MASK) << 1;
@@ -1791,7 +1865,8 @@ inline u8 Position::castling_state(Bitboard from_to) const {
   return white_oo | white_ooo | black_oo | black_ooo;
 }
 
-inline std::string Position::fen() const {
+template <typename StateHistory>
+inline std::string BasicPosition<StateHistory>::fen() const {
   std::ostringstream fen;
   i32 empty;
 
@@ -1837,7 +1912,9 @@ inline std::string Position::fen() const {
   return fen.str();
 }
 
-inline void Position::set_fen(const std::string &fen_string) {
+template <typename StateHistory>
+inline void
+BasicPosition<StateHistory>::set_fen(const std::string &fen_string) {
   reset();
 
   // Push empty state to state history.
@@ -1898,7 +1975,9 @@ inline void Position::set_fen(const std::string &fen_string) {
   state_history.top().hash ^= ZOBRIST_EP_SQUARE[state_history.top().ep_square];
 }
 
-inline std::ostream &operator<<(std::ostream &os, const Position &p) {
+template <typename StateHistory>
+inline std::ostream &operator<<(std::ostream &os,
+                                const BasicPosition<StateHistory> &p) {
   const std::string s = "   +---+---+---+---+---+---+---+---+\n";
   const std::string t = "     A   B   C   D   E   F   G   H\n";
   os << t;
@@ -1917,22 +1996,39 @@ inline std::ostream &operator<<(std::ostream &os, const Position &p) {
   return os;
 }
 
-inline bool Position::has_repetition(Repetition fold) const {
+template <typename StateHistory>
+inline bool BasicPosition<StateHistory>::has_repetition(Repetition fold) const {
   int count = fold == THREE_FOLD ? 0 : 1;
   const i32 hash_hist_size = static_cast<int>(state_history.size());
   const u64 current_hash = hash();
-  for (i32 idx = hash_hist_size - 3;
-       idx >= 0 && idx >= hash_hist_size - fifty_move_rule(); idx -= 2) {
-    ZobristHash stack_hash = state_history[idx].hash;
-    if (stack_hash == current_hash)
-      count += 1;
-    if (count >= 2)
-      return true;
+  if constexpr (std::is_same_v<StateHistory, SharedStateHistory>) {
+    // Same window as below: even plies back, fewer than fifty_move_rule().
+    const i32 window =
+        std::min<i32>(fifty_move_rule() - 1, hash_hist_size - 1);
+    const SharedStateHistory::Link *link = state_history.previous();
+    for (i32 ply = 1; link && ply <= window;
+         ply++, link = link->previous.get()) {
+      if (ply % 2 == 0 && link->state.hash == current_hash)
+        count += 1;
+      if (count >= 2)
+        return true;
+    }
+  } else {
+    for (i32 idx = hash_hist_size - 3;
+         idx >= 0 && idx >= hash_hist_size - fifty_move_rule(); idx -= 2) {
+      ZobristHash stack_hash = state_history[idx].hash;
+      if (stack_hash == current_hash)
+        count += 1;
+      if (count >= 2)
+        return true;
+    }
   }
   return false;
 }
 
-template <Color color> inline void Position::play(Move move) {
+template <typename StateHistory>
+template <Color color>
+inline void BasicPosition<StateHistory>::play(Move move) {
   PositionState next_state = {};
   next_state.from_to = state_history.peek().from_to |
                        square_to_bitboard(move.from()) |
@@ -2007,7 +2103,9 @@ template <Color color> inline void Position::play(Move move) {
   side = ~side;
 }
 
-template <Color color> inline void Position::undo(Move move) {
+template <typename StateHistory>
+template <Color color>
+inline void BasicPosition<StateHistory>::undo(Move move) {
   PositionState old_state = state_history.pop();
 
   move_piece<DISABLE_HASH_UPDATE>(move.to(), move.from());
@@ -2049,7 +2147,9 @@ template <Color color> inline void Position::undo(Move move) {
   side = ~side;
 }
 
-template <Color color> inline void Position::play_null() {
+template <typename StateHistory>
+template <Color color>
+inline void BasicPosition<StateHistory>::play_null() {
   PositionState next_state = {};
   next_state.from_to = state_history.peek().from_to;
   next_state.captured = NO_PIECE;
@@ -2063,7 +2163,9 @@ template <Color color> inline void Position::play_null() {
   state_history.push(next_state);
 }
 
-template <Color color> inline void Position::undo_null() {
+template <typename StateHistory>
+template <Color color>
+inline void BasicPosition<StateHistory>::undo_null() {
   state_history.pop();
 }
 
@@ -2101,10 +2203,12 @@ template <Color C> Bitboard ooo_blockers_mask() {
 
 /* ------------------------ DEFINE MOVE GENERATOR ------------------------ */
 
-template <Color color, MoveGenerationType move_gen_type = ALL> class MoveList {
+template <Color color, MoveGenerationType move_gen_type = ALL,
+          typename PositionType = Position>
+class MoveList {
 private:
   Stack<Move, 218> move_list{};
-  Position &board_;
+  PositionType &board_;
 
   struct SharedData {
     Bitboard us_occupancy, them_occupancy, all;
@@ -2112,21 +2216,21 @@ private:
     Bitboard us_king, them_king;
     Bitboard us_ortho_sliders, us_diag_sliders;
     Bitboard them_ortho_sliders, them_diag_sliders;
-    explicit SharedData(Position &board) {
-      us_occupancy = board.occupancy<color>();
-      them_occupancy = board.occupancy<~color>();
+    explicit SharedData(PositionType &board) {
+      us_occupancy = board.template occupancy<color>();
+      them_occupancy = board.template occupancy<~color>();
       all = us_occupancy | them_occupancy;
 
-      us_king = board.occupancy<color, KING>();
-      them_king = board.occupancy<~color, KING>();
+      us_king = board.template occupancy<color, KING>();
+      them_king = board.template occupancy<~color, KING>();
       us_king_square = lsb(us_king);
       them_king_square = lsb(them_king);
 
-      us_diag_sliders = board.diagonal_sliders<color>();
-      them_diag_sliders = board.diagonal_sliders<~color>();
+      us_diag_sliders = board.template diagonal_sliders<color>();
+      them_diag_sliders = board.template diagonal_sliders<~color>();
 
-      us_ortho_sliders = board.orthogonal_sliders<color>();
-      them_ortho_sliders = board.orthogonal_sliders<~color>();
+      us_ortho_sliders = board.template orthogonal_sliders<color>();
+      them_ortho_sliders = board.template orthogonal_sliders<~color>();
     }
   };
 
@@ -2177,18 +2281,36 @@ private:
   inline void push_promotions(Bitboard pinned, Bitboard quiet_mask,
                               Bitboard capture_mask);
 
+  // Tag for constructing a list without generating into it.
+  struct Deferred {};
+  MoveList(PositionType &board, Deferred) : board_{board} {}
+
+  // Runs every generation stage, or with stop_at_first returns after the
+  // first stage that produced a move.
+  template <bool stop_at_first> inline void generate();
+
+  template <bool stop_at_first> [[nodiscard]] inline bool done() const {
+    return stop_at_first && !move_list.empty();
+  }
+
 public:
-  explicit MoveList(Position &board);
+  explicit MoveList(PositionType &board);
+
+  // True if the side to move has a legal move. Stops at the first stage that
+  // finds one, which is usually the king's own moves.
+  [[nodiscard]] static inline bool has_legal_move(PositionType &board);
 
   [[nodiscard]] inline auto begin() const { return move_list.begin(); }
   [[nodiscard]] inline auto end() const { return move_list.end(); }
   [[nodiscard]] inline auto size() const { return move_list.size(); }
 };
 
-template <Color color, MoveGenerationType move_gen_type>
-inline void MoveList<color, move_gen_type>::push_promotions(
+template <Color color, MoveGenerationType move_gen_type,
+          typename PositionType>
+inline void MoveList<color, move_gen_type, PositionType>::push_promotions(
     Bitboard pinned, Bitboard quiet_mask, Bitboard capture_mask) {
-  Bitboard promotion_candidates = board_.occupancy<color, PAWN>() & ~pinned &
+  Bitboard promotion_candidates = board_.template occupancy<color, PAWN>() &
+                                  ~pinned &
                                   MASK_RANK[relative_rank<color>(RANK7)];
   if (!promotion_candidates)
     return;
@@ -2221,8 +2343,9 @@ inline void MoveList<color, move_gen_type>::push_promotions(
   }
 }
 
-template <Color color, MoveGenerationType move_gen_type>
-inline void MoveList<color, move_gen_type>::push_check_evasions(
+template <Color color, MoveGenerationType move_gen_type,
+          typename PositionType>
+inline void MoveList<color, move_gen_type, PositionType>::push_check_evasions(
     const MoveList::SharedData &data, Bitboard danger) {
   Bitboard evasions = tables::attacks<KING>(data.us_king_square, data.all) &
                       ~(data.us_occupancy | danger);
@@ -2231,16 +2354,17 @@ inline void MoveList<color, move_gen_type>::push_check_evasions(
   push<CAPTURE_TYPE>(data.us_king_square, evasions & data.them_occupancy);
 }
 
-template <Color color, MoveGenerationType move_gen_type>
+template <Color color, MoveGenerationType move_gen_type,
+          typename PositionType>
 inline std::pair<Bitboard, Bitboard>
-MoveList<color, move_gen_type>::generate_checkers_and_pinned(
+MoveList<color, move_gen_type, PositionType>::generate_checkers_and_pinned(
     const MoveList::SharedData &data) {
   Bitboard checkers{}, pinned{};
 
   checkers = (tables::attacks<KNIGHT>(data.us_king_square, data.all) &
-              board_.occupancy<~color, KNIGHT>()) |
+              board_.template occupancy<~color, KNIGHT>()) |
              (tables::attacks<PAWN, color>(data.us_king_square) &
-              board_.occupancy<~color, PAWN>());
+              board_.template occupancy<~color, PAWN>());
 
   Bitboard candidates =
       (tables::attacks<ROOK>(data.us_king_square, data.them_occupancy) &
@@ -2261,16 +2385,17 @@ MoveList<color, move_gen_type>::generate_checkers_and_pinned(
   return {checkers, pinned};
 }
 
-template <Color color, MoveGenerationType move_gen_type>
-inline Bitboard MoveList<color, move_gen_type>::generate_danger(
+template <Color color, MoveGenerationType move_gen_type,
+          typename PositionType>
+inline Bitboard MoveList<color, move_gen_type, PositionType>::generate_danger(
     const MoveList::SharedData &data) {
-  Bitboard danger = board_.occupancy<~color, PAWN>();
+  Bitboard danger = board_.template occupancy<~color, PAWN>();
   danger = shift_relative<~color, NORTH_WEST>(danger) |
            shift_relative<~color, NORTH_EAST>(danger);
 
   danger |= tables::attacks<KING>(data.them_king_square, data.all);
 
-  Bitboard them_knights = board_.occupancy<~color, KNIGHT>();
+  Bitboard them_knights = board_.template occupancy<~color, KNIGHT>();
   while (them_knights) {
     danger |= tables::attacks<KNIGHT>(pop_lsb(them_knights), data.all);
   }
@@ -2290,13 +2415,15 @@ inline Bitboard MoveList<color, move_gen_type>::generate_danger(
   return danger;
 }
 
-template <Color color, MoveGenerationType move_gen_type>
-inline void MoveList<color, move_gen_type>::push_pinned(
+template <Color color, MoveGenerationType move_gen_type,
+          typename PositionType>
+inline void MoveList<color, move_gen_type, PositionType>::push_pinned(
     const MoveList::SharedData &data, Bitboard pinned, Bitboard quiet_mask,
     Bitboard capture_mask) {
-  Bitboard pinned_pieces = pinned & ~board_.occupancy<color, KNIGHT>() &
-                           ~board_.occupancy<color, PAWN>();
-  Bitboard pinned_pawns = pinned & board_.occupancy<color, PAWN>();
+  Bitboard pinned_pieces = pinned &
+                           ~board_.template occupancy<color, KNIGHT>() &
+                           ~board_.template occupancy<color, PAWN>();
+  Bitboard pinned_pawns = pinned & board_.template occupancy<color, PAWN>();
 
   while (pinned_pieces) {
     const Square s = pop_lsb(pinned_pieces);
@@ -2340,16 +2467,17 @@ inline void MoveList<color, move_gen_type>::push_pinned(
   }
 }
 
-template <Color color, MoveGenerationType move_gen_type>
-inline void
-MoveList<color, move_gen_type>::push_castle(const MoveList::SharedData &data,
-                                            Bitboard danger) {
+template <Color color, MoveGenerationType move_gen_type,
+          typename PositionType>
+inline void MoveList<color, move_gen_type, PositionType>::push_castle(
+    const MoveList::SharedData &data, Bitboard danger) {
   if constexpr (move_gen_type == CAPTURES)
     return;
 
   Bitboard oo_path_in_danger = (data.all | danger) & oo_blockers_mask<color>();
 
-  if (board_.king_and_oo_rook_not_moved<color>() && !oo_path_in_danger) {
+  if (board_.template king_and_oo_rook_not_moved<color>() &&
+      !oo_path_in_danger) {
     if constexpr (color == WHITE)
       push_single<OO>(e1, g1);
     else
@@ -2360,7 +2488,8 @@ MoveList<color, move_gen_type>::push_castle(const MoveList::SharedData &data,
       (data.all | (danger & ooo_danger_mask<color>())) &
       ooo_blockers_mask<color>();
 
-  if (board_.king_and_ooo_rook_not_moved<color>() && !ooo_path_in_danger) {
+  if (board_.template king_and_ooo_rook_not_moved<color>() &&
+      !ooo_path_in_danger) {
     if constexpr (color == WHITE)
       push_single<OOO>(e1, c1);
     else
@@ -2368,15 +2497,16 @@ MoveList<color, move_gen_type>::push_castle(const MoveList::SharedData &data,
   }
 }
 
-template <Color color, MoveGenerationType move_gen_type>
-inline void MoveList<color, move_gen_type>::push_en_passant(
+template <Color color, MoveGenerationType move_gen_type,
+          typename PositionType>
+inline void MoveList<color, move_gen_type, PositionType>::push_en_passant(
     const MoveList::SharedData &data, Bitboard pinned) {
   if (board_.ep_square() == NO_SQUARE)
     return;
 
   const Bitboard ep_attackers =
       tables::attacks<PAWN, ~color>(board_.ep_square()) &
-      board_.occupancy<color, PAWN>();
+      board_.template occupancy<color, PAWN>();
 
   Bitboard unpinned_ep_attackers = ep_attackers & ~pinned;
 
@@ -2408,9 +2538,11 @@ inline void MoveList<color, move_gen_type>::push_en_passant(
   }
 }
 
-template <Color color, MoveGenerationType move_gen_type>
-inline bool MoveList<color, move_gen_type>::push_pawn_knight_check_captures(
-    const MoveList::SharedData &data, Bitboard checker, Bitboard pinned) {
+template <Color color, MoveGenerationType move_gen_type,
+          typename PositionType>
+inline bool MoveList<color, move_gen_type, PositionType>::
+    push_pawn_knight_check_captures(const MoveList::SharedData &data,
+                                    Bitboard checker, Bitboard pinned) {
   Square checker_square = lsb(checker);
 
   Bitboard ep_checker_captures, attacking_checker;
@@ -2423,7 +2555,7 @@ inline bool MoveList<color, move_gen_type>::push_pawn_knight_check_captures(
     if (checker == shift_relative<color, SOUTH>(square_to_bitboard(epsq))) {
       // We can ep capture the double pushed pawn as it is not pinned.
       ep_checker_captures = tables::attacks<PAWN, ~color>(epsq) &
-                            board_.occupancy<color, PAWN>() & ~pinned;
+                            board_.template occupancy<color, PAWN>() & ~pinned;
       while (ep_checker_captures) {
         push<ENPASSANT>(pop_lsb(ep_checker_captures), square_to_bitboard(epsq));
       }
@@ -2434,7 +2566,7 @@ inline bool MoveList<color, move_gen_type>::push_pawn_knight_check_captures(
     // Checker was a pawn or knight, we must capture (evasions assumed to be
     // handled already)
     attacking_checker =
-        board_.attackers_of<color>(checker_square, data.all) & ~pinned;
+        board_.template attackers_of<color>(checker_square, data.all) & ~pinned;
     while (attacking_checker) {
       Square s = pop_lsb(attacking_checker);
       // If they promoted to a knight, and we can capture and promote, do that.
@@ -2450,11 +2582,13 @@ inline bool MoveList<color, move_gen_type>::push_pawn_knight_check_captures(
   }
 }
 
-template <Color color, MoveGenerationType move_gen_type>
-inline void MoveList<color, move_gen_type>::push_non_pinned_pieces(
-    const MoveList::SharedData &data, Bitboard pinned, Bitboard quiet_mask,
-    Bitboard capture_mask) {
-  Bitboard un_pinned_knights = board_.occupancy<color, KNIGHT>() & ~pinned;
+template <Color color, MoveGenerationType move_gen_type,
+          typename PositionType>
+inline void MoveList<color, move_gen_type, PositionType>::
+    push_non_pinned_pieces(const MoveList::SharedData &data, Bitboard pinned,
+                           Bitboard quiet_mask, Bitboard capture_mask) {
+  Bitboard un_pinned_knights =
+      board_.template occupancy<color, KNIGHT>() & ~pinned;
   while (un_pinned_knights) {
     Square s = pop_lsb(un_pinned_knights);
     Bitboard knight_attacks = tables::attacks<KNIGHT>(s, data.all);
@@ -2484,12 +2618,14 @@ inline void MoveList<color, move_gen_type>::push_non_pinned_pieces(
   }
 }
 
-template <Color color, MoveGenerationType move_gen_type>
-inline void MoveList<color, move_gen_type>::push_non_pinned_pawns(
+template <Color color, MoveGenerationType move_gen_type,
+          typename PositionType>
+inline void MoveList<color, move_gen_type, PositionType>::push_non_pinned_pawns(
     const MoveList::SharedData &data, Bitboard pinned, Bitboard quiet_mask,
     Bitboard capture_mask) {
 
-  Bitboard non_pinned_pawns = board_.occupancy<color, PAWN>() & ~pinned &
+  Bitboard non_pinned_pawns = board_.template occupancy<color, PAWN>() &
+                              ~pinned &
                               ~MASK_RANK[relative_rank<color>(RANK7)];
 
   Bitboard left_pawn_captures =
@@ -2531,14 +2667,34 @@ inline void MoveList<color, move_gen_type>::push_non_pinned_pawns(
   }
 }
 
-template <Color color, MoveGenerationType move_gen_type>
-MoveList<color, move_gen_type>::MoveList(Position &board) : board_{board} {
+template <Color color, MoveGenerationType move_gen_type,
+          typename PositionType>
+MoveList<color, move_gen_type, PositionType>::MoveList(PositionType &board)
+    : board_{board} {
+  generate<false>();
+}
+
+template <Color color, MoveGenerationType move_gen_type,
+          typename PositionType>
+inline bool MoveList<color, move_gen_type, PositionType>::has_legal_move(
+    PositionType &board) {
+  MoveList list(board, Deferred{});
+  list.template generate<true>();
+  return !list.move_list.empty();
+}
+
+template <Color color, MoveGenerationType move_gen_type,
+          typename PositionType>
+template <bool stop_at_first>
+inline void MoveList<color, move_gen_type, PositionType>::generate() {
 
   const SharedData data(board_);
 
   Bitboard danger = generate_danger(data);
 
   push_check_evasions(data, danger);
+  if (done<stop_at_first>())
+    return;
 
   const auto [checkers, pinned] = generate_checkers_and_pinned(data);
 
@@ -2549,6 +2705,8 @@ MoveList<color, move_gen_type>::MoveList(Position &board) : board_{board} {
   case 1:
     if (push_pawn_knight_check_captures(data, checkers, pinned))
       return;
+    if (done<stop_at_first>())
+      return;
     capture_mask = checkers;
     quiet_mask = tables::square_in_between(data.us_king_square, lsb(checkers));
     break;
@@ -2558,10 +2716,16 @@ MoveList<color, move_gen_type>::MoveList(Position &board) : board_{board} {
     push_en_passant(data, pinned);
     push_castle(data, danger);
     push_pinned(data, pinned, quiet_mask, capture_mask);
+    if (done<stop_at_first>())
+      return;
     break;
   }
   push_non_pinned_pieces(data, pinned, quiet_mask, capture_mask);
+  if (done<stop_at_first>())
+    return;
   push_non_pinned_pawns(data, pinned, quiet_mask, capture_mask);
+  if (done<stop_at_first>())
+    return;
   push_promotions(pinned, quiet_mask, capture_mask);
 }
 
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "move_gen.h"
+#include <array>
+#include <cstddef>
+
+// fixed capacity list of legal moves. 218 is the most legal moves any chess
+// position has, so generateMoves never overflows it.
+struct MoveBuffer {
+  std::array<Midnight::Move, 218> moves;
+  size_t count = 0;
+
+  const Midnight::Move *begin() const { return moves.data(); }
+  const Midnight::Move *end() const { return moves.data() + count; }
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  Midnight::Move operator[](size_t i) const { return moves[i]; }
+};
+
+// fills buffer with the legal moves of the side to move.
+template <typename PositionType>
+inline void generateMoves(PositionType &board, MoveBuffer &buffer) {
+  auto fill = [&](const auto &movelist) {
+    buffer.count = movelist.size();
+    std::copy(movelist.begin(), movelist.end(), buffer.moves.begin());
+  };
+
+  if (board.turn() == Midnight::WHITE) {
+    fill(Midnight::MoveList<Midnight::WHITE, Midnight::ALL, PositionType>(
+        board));
+  } else {
+    fill(Midnight::MoveList<Midnight::BLACK, Midnight::ALL, PositionType>(
+        board));
+  }
+}
+
+// checks whether the side to move has a legal move without generating the
+// whole list.
+template <typename PositionType> inline bool hasLegalMove(PositionType &board) {
+  if (board.turn() == Midnight::WHITE) {
+    return Midnight::MoveList<Midnight::WHITE, Midnight::ALL,
+                              PositionType>::has_legal_move(board);
+  }
+  return Midnight::MoveList<Midnight::BLACK, Midnight::ALL,
+                            PositionType>::has_legal_move(board);
+}
+
+template <typename PositionType>
+inline void playMove(PositionType &board, const Midnight::Move move) {
+  if (board.turn() == Midnight::WHITE) {
+    board.template play<Midnight::WHITE>(move);
+  } else {
+    board.template play<Midnight::BLACK>(move);
+  }
+}
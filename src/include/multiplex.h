@@ -0,0 +1,109 @@
+#pragma once
+
+#include "dnn.h"
+#include "mcts.h"
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <utility>
+#include <vector>
+
+// a search or game running as a coroutine on the driving thread. it starts
+// suspended and suspends again whenever it waits for the network, so one
+// thread can interleave hundreds of them.
+class SearchTask {
+public:
+  struct promise_type {
+    SearchTask get_return_object() {
+      return SearchTask(
+          std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+
+  explicit SearchTask(std::coroutine_handle<promise_type> _handle)
+      : handle(_handle) {}
+  SearchTask(SearchTask &&other) noexcept
+      : handle(std::exchange(other.handle, {})) {}
+  SearchTask(const SearchTask &) = delete;
+  SearchTask &operator=(const SearchTask &) = delete;
+  ~SearchTask() {
+    if (handle) {
+      handle.destroy();
+    }
+  }
+
+  void resume() { handle.resume(); }
+  bool done() const { return handle.done(); }
+
+private:
+  std::coroutine_handle<promise_type> handle;
+};
+
+// collects the input batches of suspended searches, so one forward pass
+// evaluates the leaves of every search that is waiting, up to maxBatch
+// positions per pass.
+class BatchEvaluator {
+private:
+  struct Request {
+    torch::Tensor input;
+    Eval *outputs;
+    std::coroutine_handle<> handle;
+  };
+
+  DNN &model;
+  torch::Device device;
+  size_t maxBatch;
+  std::vector<Request> pending;
+
+  // evaluates requests in one forward pass and resumes their coroutines.
+  void forward(std::vector<Request> &requests);
+
+public:
+  uint64_t forwardPasses = 0;
+  uint64_t positions = 0;
+  double inferenceTime = 0; // seconds.
+
+  // suspends the awaiting coroutine until flush has evaluated input.
+  struct Awaiter {
+    BatchEvaluator &evaluator;
+    torch::Tensor input;
+    Eval outputs = Eval(torch::Tensor(), torch::Tensor());
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+      evaluator.pending.push_back({input, &outputs, handle});
+    }
+    Eval await_resume() { return outputs; }
+  };
+
+  BatchEvaluator(DNN &_model, const torch::Device &_device, size_t _maxBatch)
+      : model(_model), device(_device), maxBatch(_maxBatch) {}
+
+  Awaiter evaluate(const torch::Tensor &input) { return {*this, input}; }
+  bool idle() const { return pending.empty(); }
+
+  // evaluates every pending input in passes of at most maxBatch positions,
+  // resuming each pass's coroutines, which queue their next inputs before
+  // suspending. a single input larger than maxBatch gets a pass to itself.
+  void flush();
+};
+
+// a coroutine searches with the steps of getNextMove from mcts.h, awaiting
+// the evaluator in place of the forward pass:
+//   startSearch(node, g);
+//   while (!searchDone(node, g)) {
+//     if (gatherBatch(node, g)) {
+//       Eval outputs = co_await evaluator.evaluate(encodeBatch(g));
+//       backupBatch(outputs, g);
+//     }
+//   }
+//   Node *selected = finishSearch(node, temperature, g);
+
+// resumes every task, then flushes the evaluator until no task is waiting.
+// all tasks have finished when it returns.
+void runTasks(std::vector<SearchTask> &tasks, BatchEvaluator &evaluator);
@@ -1,17 +1,52 @@
 #pragma once
 
+#include <array>
 #include <cmath>
+#include <cstdint>
+#include <cstddef>
 #include <mutex>
-#include <set>
+#include <new>
+#include <vector>
 #include "move_gen.h"
 
-// one node in the mcts game tree.
+// the bitboards one history board contributes to the network input: white
+// then black pawn, knight, bishop, rook, queen and king, then the two
+// repetition planes.
+typedef std::array<uint64_t, 14> BoardPlanes;
+
+struct Node;
+
+// a move out of a node with its policy prior. the child node is only
+// allocated when selection first picks the edge, since most moves of most
+// nodes are never visited. visits counts the simulations that went through
+// this edge; in a tree it equals the child's visit count, in a graph the
+// child also collects visits from its other parents. owner is set on the
+// one edge that frees the child, and clear on edges that reach it through
+// a transposition.
+struct Edge {
+  Midnight::Move move;
+  float prior;
+  Node *child = nullptr;
+  uint32_t visits = 0;
+  bool owner = false;
+};
+
+// a block of nodes that compaction relocated together. it is freed when
+// its last node is deleted.
+struct NodeArena {
+  void *memory;
+  size_t live;
+};
+
+// one node in the mcts game tree, or graph when transpositions are shared.
+// parent is the node the owning edge leaves from, whose ancestors give the
+// node its history.
 struct Node {
   int threadIndex;
   Node *parent;
-  std::set<Node *> children;
+  std::vector<Edge> edges;
   std::mutex childLock;
-  Midnight::Position position;
+  Midnight::SharedPosition position;
 
   float totalValue = 0;
   uint32_t visitCount = 0;
@@ -21,24 +56,29 @@ struct Node {
 
   bool initialized = false;
 
+  // earlier occurrences of this position on the game path, capped at 2. -1
+  // until the node is first reached by a descent.
+  int8_t repetitions = -1;
+
+  // this board's input planes, encoded once alongside repetitions so a
+  // leaf's history is read from its ancestors instead of re-encoded.
+  BoardPlanes planes = {};
+
   uint32_t batchNum = 0;
 
   float valueEval = INFINITY;
-  float policyEval;
 
-  Node(Node *_parent, const std::set<Node *> _children,
-       const Midnight::Position _position) {
-    parent = _parent;
-    children = _children;
-    position = _position;
-  }
+  // the exact value for the side that moved into this node, from a terminal
+  // position, a tablebase hit or children that decide it. INFINITY while
+  // unproven.
+  float provenValue = INFINITY;
+
+  // the block holding this node, or nullptr when it was allocated alone.
+  NodeArena *arena = nullptr;
 
-  Node(Node *_parent, const std::set<Node *> _children,
-       const Midnight::Position _position, float _policy) {
+  Node(Node *_parent, const Midnight::SharedPosition _position) {
     parent = _parent;
-    children = _children;
     position = _position;
-    policyEval = _policy;
   }
 
   void reinitializeBatch() {
@@ -47,8 +87,23 @@ struct Node {
   }
 
   ~Node() {
-    for (Node *node : children) {
-      delete node;
+    for (Edge &edge : edges) {
+      if (edge.owner) {
+        delete edge.child;
+      }
+    }
+  }
+
+  // deleting a node in an arena releases its slot, and the last slot frees
+  // the block.
+  void operator delete(Node *node, std::destroying_delete_t) {
+    NodeArena *arena = node->arena;
+    node->~Node();
+    if (arena == nullptr) {
+      ::operator delete(node);
+    } else if (--arena->live == 0) {
+      ::operator delete(arena->memory);
+      delete arena;
     }
   }
 };
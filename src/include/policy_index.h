@@ -0,0 +1,106 @@
+#pragma once
+
+#include "constants.h"
+#include "move_gen.h"
+#include "moves.h"
+#include <array>
+#include <cstdint>
+
+// the policy head has 73 move planes per from square, as in AlphaZero:
+//   0-55  queen-like moves, 7 distances in each of 8 directions.
+//   56-63 knight moves.
+//   64-72 underpromotions to knight, bishop or rook, straight or capturing
+//         towards either file.
+// queen promotions use the queen-like planes. planes are not flipped for
+// black.
+constexpr int MOVE_PLANES = 73;
+
+constexpr int KDX[8] = {1, 2, 2, 1, -1, -2, -2, -1};
+constexpr int KDY[8] = {2, 1, -1, -2, -2, -1, 1, 2};
+
+// promotion slot used by the tables: 0 for queen promotions and every other
+// move, 1-3 for knight, bishop and rook underpromotions.
+constexpr int PROMOTION_SLOTS = 4;
+
+inline int promotionSlot(Midnight::Move move) {
+  if (!move.is_promotion() || (move.type() & 0b0111) == Midnight::PR_QUEEN) {
+    return 0;
+  }
+  return (move.type() & 0b0011) + 1;
+}
+
+// the policy index of a move, or -1 when from and to are not a queen or
+// knight move apart.
+constexpr int computePolicyIndex(int from, int to, int promotion) {
+  int dx = to % 8 - from % 8;
+  int dy = to / 8 - from / 8;
+  int adx = dx < 0 ? -dx : dx;
+  int ady = dy < 0 ? -dy : dy;
+  int xCode = dx == 0 ? 0 : dx > 0 ? 1 : 2;
+  int yCode = dy == 0 ? 0 : dy > 0 ? 1 : 2;
+
+  if (from == to) {
+    return -1;
+  }
+  if (promotion != 0) {
+    // white promotes from the seventh rank, black from the second, so the
+    // file offset alone identifies the move.
+    bool white = from / 8 == 6 && dy == 1;
+    bool black = from / 8 == 1 && dy == -1;
+    if ((!white && !black) || adx > 1) {
+      return -1;
+    }
+    return from * MOVE_PLANES + 64 + (promotion - 1) * 3 + xCode;
+  }
+  for (int i = 0; i < 8; i++) {
+    if (dx == KDX[i] && dy == KDY[i]) {
+      return from * MOVE_PLANES + 56 + i;
+    }
+  }
+  if (adx != 0 && ady != 0 && adx != ady) {
+    return -1;
+  }
+  int distance = adx > ady ? adx : ady;
+  int direction = xCode + 3 * yCode - 1;
+  return from * MOVE_PLANES + direction * 7 + distance - 1;
+}
+
+constexpr std::array<int16_t, 64 * 64 * PROMOTION_SLOTS> buildMoveToPolicy() {
+  std::array<int16_t, 64 * 64 * PROMOTION_SLOTS> table{};
+  for (int from = 0; from < 64; from++) {
+    for (int to = 0; to < 64; to++) {
+      for (int promotion = 0; promotion < PROMOTION_SLOTS; promotion++) {
+        table[(from * 64 + to) * PROMOTION_SLOTS + promotion] =
+            computePolicyIndex(from, to, promotion);
+      }
+    }
+  }
+  return table;
+}
+
+constexpr std::array<int16_t, 64 * 64 * PROMOTION_SLOTS> MOVE_TO_POLICY =
+    buildMoveToPolicy();
+
+// returns the index for the policy tensor that corresponds to a move.
+inline int policyIndex(Midnight::Move move) {
+  return MOVE_TO_POLICY[(move.from() * 64 + move.to()) * PROMOTION_SLOTS +
+                        promotionSlot(move)];
+}
+
+// a position's legal moves with the policy index of each.
+struct LegalPolicy {
+  MoveBuffer moves;
+  std::array<int16_t, 218> indices;
+};
+
+template <typename PositionType>
+inline void legalPolicy(PositionType &board, LegalPolicy &legal) {
+  generateMoves(board, legal.moves);
+  for (size_t i = 0; i < legal.moves.size(); i++) {
+    legal.indices[i] = policyIndex(legal.moves[i]);
+  }
+}
+
+// writes the softmax of logits over the legal moves into priors, which is
+// parallel to legal.moves.
+void legalPriors(const float *logits, const LegalPolicy &legal, float *priors);
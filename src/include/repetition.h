@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// counts how often each Zobrist key occurs on the current search path, so a
+// repetition check during descent is one lookup instead of a walk over the
+// position's history. keys are pushed as the descent enters a position and
+// popped as it returns. the table is small open addressing with linear
+// probing; it only holds the root's reversible history (at most 100 plies)
+// plus the descent path, so it stays well under half full.
+class RepetitionTracker {
+private:
+  static constexpr size_t SLOTS = 1024; // power of two.
+  static constexpr size_t MASK = SLOTS - 1;
+
+  struct Slot {
+    uint64_t key = 0; // 0 marks an empty slot.
+    uint32_t count = 0;
+  };
+
+  std::array<Slot, SLOTS> table{};
+  std::vector<uint64_t> path;
+
+  size_t find(uint64_t key) const {
+    size_t i = key & MASK;
+    while (table[i].key != 0 && table[i].key != key) {
+      i = (i + 1) & MASK;
+    }
+    return i;
+  }
+
+  // backward shift deletion keeps probe chains intact without tombstones.
+  void erase(size_t hole) {
+    size_t i = hole;
+    while (true) {
+      i = (i + 1) & MASK;
+      if (table[i].key == 0) {
+        break;
+      }
+      size_t home = table[i].key & MASK;
+      if (((i - home) & MASK) >= ((i - hole) & MASK)) {
+        table[hole] = table[i];
+        hole = i;
+      }
+    }
+    table[hole] = {};
+  }
+
+public:
+  RepetitionTracker() { path.reserve(256); }
+
+  void clear() {
+    table.fill({});
+    path.clear();
+  }
+
+  void push(uint64_t key) {
+    Slot &slot = table[find(key)];
+    slot.key = key;
+    slot.count += 1;
+    path.push_back(key);
+  }
+
+  void pop() {
+    size_t i = find(path.back());
+    path.pop_back();
+    if (--table[i].count == 0) {
+      erase(i);
+    }
+  }
+
+  // occurrences of key on the path, including the current position.
+  uint32_t count(uint64_t key) const { return table[find(key)].count; }
+};
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// a unit of work for the Scheduler. run is called once with the index of
+// the worker running it, or -1 on a thread outside the pool, and pending is
+// decremented after it returns. the scheduler never allocates or frees
+// tasks: whoever spawns one keeps it alive until pending says it ran.
+struct Task {
+  void (*run)(Task *task, int worker) = nullptr;
+  std::atomic<int64_t> *pending = nullptr;
+};
+
+// a task around a std::function, for long tasks such as whole games where
+// one allocation per task does not matter.
+struct FunctionTask : Task {
+  std::function<void(int)> function;
+
+  FunctionTask() = default;
+  FunctionTask(std::function<void(int)> _function,
+               std::atomic<int64_t> *_pending)
+      : function(std::move(_function)) {
+    run = [](Task *task, int worker) {
+      static_cast<FunctionTask *>(task)->function(worker);
+    };
+    pending = _pending;
+  }
+};
+
+// a Chase-Lev work-stealing deque of task pointers with a fixed capacity.
+// only the owning worker pushes and pops, at the bottom; any thread may
+// steal from the top without taking a lock.
+class TaskDeque {
+private:
+  static constexpr int64_t CAPACITY = 4096; // power of two.
+  static constexpr int64_t MASK = CAPACITY - 1;
+
+  alignas(64) std::atomic<int64_t> top{0};
+  alignas(64) std::atomic<int64_t> bottom{0};
+  std::unique_ptr<std::atomic<Task *>[]> buffer{
+      new std::atomic<Task *>[CAPACITY]};
+
+public:
+  // returns false when the deque is full.
+  bool push(Task *task);
+  Task *pop();   // nullptr when empty.
+  Task *steal(); // nullptr when empty or another thread won the race.
+};
+
+// a work-stealing thread pool. each worker runs tasks from the bottom of its
+// own deque and steals from the top of the others' when it runs dry, so a
+// worker that spawns work keeps the cache-hot end and thieves take the
+// oldest, largest pieces. threads outside the pool queue their tasks on a
+// shared injection list instead, and their parallelFor chunks on a second
+// list served before it. idle workers spin briefly, then sleep until the
+// next spawn.
+class Scheduler {
+public:
+  explicit Scheduler(int threads);
+  // every spawned task must have finished.
+  ~Scheduler();
+
+  // deques is complete before any worker starts, so workers may read it.
+  int size() const { return static_cast<int>(deques.size()); }
+
+  // queues count tasks laid out in an array of T, a type derived from Task.
+  template <typename T> void spawn(T *tasks, size_t count) {
+    queue(tasks, count, injected, injectedCount);
+  }
+
+  // runs queued tasks on the calling thread until pending reaches zero. only
+  // a top-level wait for the games should pass takeInjected: injected tasks
+  // may be whole games, and a thread waiting on a few chunks must not start
+  // one of those. a nested wait yields between tries, since its chunks are
+  // short; the top-level one sleeps once there is nothing left it may take.
+  void wait(const std::atomic<int64_t> &pending, bool takeInjected = false);
+
+  // calls fn(chunkBegin, chunkEnd) over [begin, end) in chunks of grain,
+  // running the first chunk on the calling thread. fn must be safe to call
+  // concurrently. up to 16 chunks need no allocation.
+  template <typename F>
+  void parallelFor(int64_t begin, int64_t end, int64_t grain, const F &fn) {
+    const int64_t chunks = (end - begin + grain - 1) / grain;
+    if (chunks <= 1) {
+      if (begin < end) {
+        fn(begin, end);
+      }
+      return;
+    }
+
+    struct Chunk : Task {
+      const F *fn;
+      int64_t begin;
+      int64_t end;
+    };
+    Chunk local[16];
+    std::vector<Chunk> heap;
+    Chunk *tasks = local;
+    if (chunks - 1 > 16) {
+      heap.resize(chunks - 1);
+      tasks = heap.data();
+    }
+
+    std::atomic<int64_t> pending = chunks - 1;
+    for (int64_t i = 1; i < chunks; i++) {
+      Chunk &chunk = tasks[i - 1];
+      chunk.run = [](Task *task, int) {
+        Chunk *self = static_cast<Chunk *>(task);
+        (*self->fn)(self->begin, self->end);
+      };
+      chunk.pending = &pending;
+      chunk.fn = &fn;
+      chunk.begin = begin + i * grain;
+      chunk.end = std::min(end, chunk.begin + grain);
+    }
+    // outside the pool the chunks must not queue behind unstarted games.
+    queue(tasks, chunks - 1, injectedChunks, injectedChunkCount);
+    fn(begin, begin + grain);
+    wait(pending);
+  }
+
+private:
+  std::vector<std::thread> workers;
+  std::vector<std::unique_ptr<TaskDeque>> deques;
+
+  std::mutex injectLock;
+  std::deque<Task *> injected;
+  std::atomic<size_t> injectedCount{0};
+  std::deque<Task *> injectedChunks; // parallelFor chunks from outside.
+  std::atomic<size_t> injectedChunkCount{0};
+
+  // spawns bump epoch; a worker only sleeps if epoch has not moved since
+  // it last looked for work.
+  std::mutex sleepLock;
+  std::condition_variable sleepSignal;
+  std::atomic<uint64_t> epoch{0};
+  std::atomic<int> sleeping{0};
+  std::atomic<bool> stopping{false};
+
+  // top-level waiters asleep until their count reaches zero or an
+  // injected task arrives.
+  std::condition_variable parkSignal;
+  std::atomic<int> parked{0};
+
+  // pushes count tasks onto the calling worker's deque, or from outside
+  // the pool onto list, and wakes whoever may take them.
+  template <typename T>
+  void queue(T *tasks, size_t count, std::deque<Task *> &list,
+             std::atomic<size_t> &listCount) {
+    int self = workerIndex();
+    if (self >= 0) {
+      for (size_t i = 0; i < count; i++) {
+        if (!deques[self]->push(&tasks[i])) {
+          runTask(&tasks[i], self);
+        }
+      }
+    } else {
+      {
+        std::lock_guard<std::mutex> guard(injectLock);
+        for (size_t i = 0; i < count; i++) {
+          list.push_back(&tasks[i]);
+        }
+        listCount.fetch_add(count);
+      }
+      if (parked.load() > 0) {
+        wakeParked();
+      }
+    }
+    wake();
+  }
+
+  int workerIndex() const;
+  void wake();
+  void wakeParked();
+  void park(const std::atomic<int64_t> &pending);
+  void workerLoop(int index);
+  Task *findTask(int self, bool takeInjected);
+  void runTask(Task *task, int worker);
+};
+
+// the process-wide scheduler, with one worker per hardware thread. game
+// threads and the batch encoder share it.
+Scheduler &defaultScheduler();
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "constants.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// a shared memory transport between search processes and one inference
+// server process on the same host. every client owns a ring of request
+// slots. it writes input planes straight into a slot, the server runs
+// them through the network in place and writes the value and policy back
+// into the same slot, so nothing is copied between the processes. waits
+// are futexes on the shared words, so neither side polls.
+
+constexpr uint32_t RING_SLOTS = 4;   // requests a client may have in flight.
+constexpr uint32_t RING_LEAVES = 64; // max leaves per request.
+// how long the server may go without a heartbeat, as in one very slow
+// forward pass, before its clients give up on it.
+constexpr std::chrono::seconds RING_SERVER_TIMEOUT(30);
+
+enum SlotState : uint32_t { SLOT_FREE, SLOT_REQUESTED, SLOT_ANSWERED };
+
+// one request and its answer.
+struct RingSlot {
+  std::atomic<uint32_t> state{SLOT_FREE};
+  uint32_t count = 0; // leaves in this request.
+  alignas(64) float planes[RING_LEAVES * INPUT_PLANES * 64];
+  float value[RING_LEAVES];
+  float policy[RING_LEAVES * POLICY_SIZE];
+};
+
+// one client's ring. the client uses the slots in order, and the server
+// answers them in the same order.
+struct RingChannel {
+  std::atomic<bool> attached{false};
+  std::atomic<bool> detached{false};
+  // the attached client's process, so the server can tell a client that
+  // died without detaching.
+  std::atomic<int32_t> clientPid{0};
+  RingSlot slots[RING_SLOTS];
+};
+
+// the start of the shared region, followed by clients channels.
+struct RingHeader {
+  uint64_t magic;
+  uint32_t clients;
+  // bumped by every submit and detach, so the server sleeps on one word
+  // for all clients.
+  std::atomic<uint32_t> doorbell{0};
+  // the server's process and the steady clock in ms at its last beat, so
+  // clients can tell whether it still runs.
+  int32_t serverPid = 0;
+  std::atomic<int64_t> heartbeat{0};
+};
+
+// a mapping of the shared region, as created by the server or opened by a
+// client.
+class SharedRing {
+private:
+  std::string name;
+  void *memory = nullptr;
+  size_t bytes = 0;
+  bool owner = false; // whether this side created and unlinks the region.
+
+  bool map(int fd, size_t size);
+
+public:
+  SharedRing() = default;
+  SharedRing(const SharedRing &) = delete;
+  SharedRing &operator=(const SharedRing &) = delete;
+  // unmaps the region, and unlinks it on the side that created it.
+  ~SharedRing();
+
+  // creates the region name with room for clients channels. returns false
+  // if it cannot, for instance because it already exists.
+  bool create(const std::string &_name, uint32_t clients);
+  // maps a region the server created. returns false if there is none.
+  bool open(const std::string &_name);
+
+  RingHeader &header() const { return *static_cast<RingHeader *>(memory); }
+  RingChannel &channel(uint32_t client) const;
+
+  // stamps the heartbeat. the server beats at least once per loop.
+  void beat();
+  // whether the server process exists and beat within RING_SERVER_TIMEOUT.
+  bool serverAlive() const;
+
+  static size_t regionBytes(uint32_t clients);
+};
+
+// the client side of one channel. requests are submitted and answered in
+// ring order.
+class RingClient {
+private:
+  SharedRing &ring;
+  RingChannel &channel;
+  uint32_t head = 0; // requests submitted so far.
+  bool attachedHere = false;
+  bool serverLost = false; // a wait found the server gone.
+
+public:
+  // attaches to channel client. the caller checks attached().
+  RingClient(SharedRing &_ring, uint32_t client);
+  // tells the server this client is done.
+  ~RingClient();
+
+  bool attached() const { return attachedHere; }
+  bool lost() const { return serverLost; }
+
+  // the slot the next submit publishes. the request that last used it must
+  // have been released.
+  RingSlot &next();
+  // publishes next() with count leaves and returns it.
+  RingSlot &submit(uint32_t count);
+  // blocks until the server has answered slot. returns false, and the
+  // client is lost for good, if the server died or stopped beating first.
+  bool wait(RingSlot &slot);
+  // hands an answered slot back once its outputs have been read.
+  void release(RingSlot &slot);
+};
+
+// whether pid is a running process. one owned by another user counts.
+bool processAlive(int32_t pid);
+
+// futex waits and wakes on a word of shared memory. wait returns when word
+// no longer holds expected, on a wake, or after timeout.
+void futexWait(std::atomic<uint32_t> &word, uint32_t expected,
+               std::chrono::milliseconds timeout);
+void futexWake(std::atomic<uint32_t> &word);
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "move_gen.h"
+#include <string>
+
+// optional Syzygy tablebase probing through Fathom. builds without Fathom
+// (see FATHOM_DIR in CMakeLists.txt) compile every probe to a miss.
+
+// loads the tablebase files under path, a list separated like $PATH.
+// returns false when nothing was loaded.
+bool initTablebases(const std::string &path);
+
+// the most pieces, kings included, that the loaded files cover. 0 when no
+// tablebases are loaded.
+int tablebasePieces();
+
+// probes the win/draw/loss table. on a hit, value is 1, 0 or -1 for the
+// side to move. cursed wins and blessed losses count as draws, since the
+// fifty-move rule decides them.
+bool probeWDL(const Midnight::SharedPosition &board, float &value);
+
+// probes the distance-to-zero table at the root. on a hit, move preserves
+// the tablebase result and value is the result for the side to move. calls
+// are serialized.
+bool probeRoot(const Midnight::SharedPosition &board, Midnight::Move &move,
+               float &value);
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "constants.h"
+#include <chrono>
+#include <cstdint>
+
+// time kept back on every move for latency outside the search, in
+// milliseconds.
+constexpr int64_t MOVE_OVERHEAD_MS = 30;
+// moves left in the game assumed when the time control does not say.
+constexpr int DEFAULT_MOVES_TO_GO = 30;
+// share of the remaining time one move may use at most.
+constexpr double MAX_MOVE_SHARE = 0.25;
+
+// the clock of the side to move.
+struct Clock {
+  int64_t timeMs;          // time left on the clock.
+  int64_t incrementMs = 0; // time added after every move.
+  int movesToGo = 0;       // moves until the next time control, 0 if none.
+};
+
+// when getNextMove stops searching. a search with a time budget runs until
+// another batch would likely end past it, however many simulations that is.
+struct SearchLimits {
+  uint32_t simulations = SIMULATIONS;
+  double seconds = 0; // time budget for the move, 0 for none.
+  // stop once no remaining simulations could change the most visited root
+  // child. the leader must also be ahead by earlyStopMargin visits.
+  bool earlyStop = true;
+  uint32_t earlyStopMargin = 0;
+
+  bool timed() const { return seconds > 0; }
+};
+
+// the limits for one move under a clock.
+SearchLimits timedLimits(const Clock &clock);
+
+// whether a timed search should stop before its next batch. elapsed is the
+// search's time so far and batches the batches it ran, which give the rate
+// used to predict when the next batch would end.
+bool outOfTime(const SearchLimits &limits, double elapsed, uint64_t batches);
+
+// simulations the search can still run: the rest of the simulation budget,
+// or for a timed search what the rate so far fits in the time left.
+uint32_t remainingSimulations(const SearchLimits &limits, uint32_t simulations,
+                              double elapsed);
@@ -0,0 +1,105 @@
+#include "inference_server.h"
+#include "constants.h"
+#include "instrument.h"
+#include <chrono>
+#include <cstring>
+#include <torch/torch.h>
+#include <vector>
+
+// how long the server sleeps without requests before it checks whether
+// every client has detached or died.
+constexpr std::chrono::milliseconds IDLE_WAIT(100);
+
+// whether every client has detached or died without detaching. a client
+// that has not attached yet is still to come.
+static bool clientsGone(SharedRing &ring) {
+  for (uint32_t client = 0; client < ring.header().clients; client++) {
+    RingChannel &channel = ring.channel(client);
+    if (channel.detached.load()) {
+      continue;
+    }
+    int32_t pid = channel.clientPid.load();
+    if (pid == 0 || processAlive(pid)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+ServerStats serveInference(SharedRing &ring, DNN &model,
+                           const torch::Device &device) {
+  torch::NoGradGuard no_grad;
+  RingHeader &header = ring.header();
+  std::vector<uint32_t> tails(header.clients, 0);
+  ServerStats stats;
+
+  while (true) {
+    ring.beat();
+    uint32_t seen = header.doorbell.load();
+
+    // every client answers in ring order, so its requests start at its
+    // tail.
+    std::vector<RingSlot *> requests;
+    bool detached = true;
+    for (uint32_t client = 0; client < header.clients; client++) {
+      RingChannel &channel = ring.channel(client);
+      detached = detached && channel.detached.load();
+      for (uint32_t i = 0; i < RING_SLOTS; i++) {
+        RingSlot &slot = channel.slots[tails[client] % RING_SLOTS];
+        if (slot.state.load(std::memory_order_acquire) != SLOT_REQUESTED) {
+          break;
+        }
+        requests.push_back(&slot);
+        tails[client]++;
+      }
+    }
+    // a crashed client never detaches, so only an idle server pays for
+    // checking the client processes.
+    if (requests.empty()) {
+      if (detached || clientsGone(ring)) {
+        return stats;
+      }
+      futexWait(header.doorbell, seen, IDLE_WAIT);
+      continue;
+    }
+
+    std::vector<torch::Tensor> inputs;
+    int64_t positions = 0;
+    for (RingSlot *slot : requests) {
+      int64_t count = slot->count;
+      inputs.push_back(
+          torch::from_blob(slot->planes, {count, INPUT_PLANES, 8, 8},
+                           torch::TensorOptions().dtype(torch::kFloat)));
+      positions += count;
+    }
+    torch::Tensor input =
+        (inputs.size() == 1 ? inputs[0] : torch::cat(inputs, 0)).to(device);
+
+    auto start = std::chrono::steady_clock::now();
+    Eval outputs = [&] {
+      INSTRUMENT_LATENCY(INFERENCE, INFERENCE_LATENCY_US);
+      return model->forward(input);
+    }();
+    torch::Tensor value = outputs.value.to(torch::kCPU).contiguous();
+    torch::Tensor policy = outputs.policy.to(torch::kCPU).contiguous();
+    stats.inferenceTime += std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+    ring.beat();
+    stats.forwardPasses += 1;
+    stats.positions += positions;
+    INSTRUMENT_RECORD(BATCH_SIZE, positions);
+
+    const float *valuePtr = value.data_ptr<float>();
+    const float *policyPtr = policy.data_ptr<float>();
+    for (RingSlot *slot : requests) {
+      std::memcpy(slot->value, valuePtr, slot->count * sizeof(float));
+      std::memcpy(slot->policy, policyPtr,
+                  slot->count * POLICY_SIZE * sizeof(float));
+      valuePtr += slot->count;
+      policyPtr += slot->count * POLICY_SIZE;
+      slot->state.store(SLOT_ANSWERED, std::memory_order_release);
+      futexWake(slot->state);
+    }
+  }
+}
@@ -0,0 +1,212 @@
+#include "instrument.h"
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace instrument {
+
+static const char *COUNTER_NAMES[COUNTER_COUNT] = {
+    "simulations", "nn_evals",   "collisions",
+    "lock_acquires", "lock_spins", "tablebase_hits"};
+static const char *TIMER_NAMES[TIMER_COUNT] = {
+    "get_next_move", "get_batch", "put_batch", "evaluate", "inference"};
+static const char *HISTOGRAM_NAMES[HISTOGRAM_COUNT] = {
+    "selection_depth", "batch_size", "inference_latency_us",
+    "leaf_latency_us"};
+
+// selection depth is bucketed linearly, the rest by powers of two.
+static const bool HISTOGRAM_LINEAR[HISTOGRAM_COUNT] = {true, false, false,
+                                                       false};
+constexpr int BUCKETS = 64;
+
+// one thread's slots. only the owning thread writes, so increments are a
+// relaxed load and store instead of a locked add.
+struct ThreadData {
+  std::array<std::atomic<uint64_t>, COUNTER_COUNT> counters{};
+  std::array<std::atomic<uint64_t>, TIMER_COUNT> timerCalls{};
+  std::array<std::atomic<uint64_t>, TIMER_COUNT> timerTicks{};
+  std::array<std::array<std::atomic<uint64_t>, BUCKETS>, HISTOGRAM_COUNT>
+      histograms{};
+};
+
+static void add(std::atomic<uint64_t> &slot, uint64_t n) {
+  slot.store(slot.load(std::memory_order_relaxed) + n,
+             std::memory_order_relaxed);
+}
+
+static uint64_t read(const std::atomic<uint64_t> &slot) {
+  return slot.load(std::memory_order_relaxed);
+}
+
+// thread data outlives its thread so totals keep finished games.
+struct Registry {
+  std::mutex lock;
+  std::vector<ThreadData *> threads;
+  std::chrono::steady_clock::time_point startTime =
+      std::chrono::steady_clock::now();
+  uint64_t startTicks = ticks();
+};
+
+static Registry &registry() {
+  static Registry instance;
+  return instance;
+}
+
+static ThreadData &local() {
+  thread_local ThreadData *data = [] {
+    ThreadData *created = new ThreadData();
+    Registry &r = registry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    r.threads.push_back(created);
+    return created;
+  }();
+  return *data;
+}
+
+uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+void count(Counter counter, uint64_t n) { add(local().counters[counter], n); }
+
+void record(Histogram histogram, uint64_t value) {
+  int bucket;
+  if (HISTOGRAM_LINEAR[histogram]) {
+    bucket = value < BUCKETS ? value : BUCKETS - 1;
+  } else {
+    bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+    bucket = bucket < BUCKETS ? bucket : BUCKETS - 1;
+  }
+  add(local().histograms[histogram][bucket], 1);
+}
+
+ScopedTimer::ScopedTimer(Timer _timer, Histogram _histogram)
+    : timer(_timer), histogram(_histogram), start(ticks()) {}
+
+ScopedTimer::~ScopedTimer() {
+  uint64_t elapsed = ticks() - start;
+  ThreadData &data = local();
+  add(data.timerCalls[timer], 1);
+  add(data.timerTicks[timer], elapsed);
+
+  if (histogram != HISTOGRAM_COUNT) {
+    Registry &r = registry();
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - r.startTime)
+                         .count();
+    double ticksPerSecond = seconds > 0 ? (ticks() - r.startTicks) / seconds : 0;
+    if (ticksPerSecond > 0) {
+      record(histogram, elapsed / ticksPerSecond * 1e6);
+    }
+  }
+}
+
+void dumpJson(std::ostream &os) {
+  Registry &r = registry();
+  std::lock_guard<std::mutex> guard(r.lock);
+
+  double uptime = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - r.startTime)
+                      .count();
+  double ticksPerSecond = uptime > 0 ? (ticks() - r.startTicks) / uptime : 1;
+
+  os << "{\n  \"uptime_s\": " << uptime
+     << ",\n  \"threads\": " << r.threads.size() << ",\n  \"counters\": {";
+  for (int i = 0; i < COUNTER_COUNT; i++) {
+    uint64_t total = 0;
+    for (ThreadData *data : r.threads) {
+      total += read(data->counters[i]);
+    }
+    os << (i ? ", " : "") << "\"" << COUNTER_NAMES[i] << "\": " << total;
+  }
+
+  os << "},\n  \"timers\": {";
+  for (int i = 0; i < TIMER_COUNT; i++) {
+    uint64_t calls = 0;
+    uint64_t total = 0;
+    for (ThreadData *data : r.threads) {
+      calls += read(data->timerCalls[i]);
+      total += read(data->timerTicks[i]);
+    }
+    double seconds = total / ticksPerSecond;
+    os << (i ? "," : "") << "\n    \"" << TIMER_NAMES[i]
+       << "\": {\"calls\": " << calls << ", \"seconds\": " << seconds
+       << ", \"mean_us\": " << (calls ? seconds / calls * 1e6 : 0) << "}";
+  }
+
+  os << "\n  },\n  \"histograms\": {";
+  for (int i = 0; i < HISTOGRAM_COUNT; i++) {
+    std::array<uint64_t, BUCKETS> buckets{};
+    int last = 0;
+    for (ThreadData *data : r.threads) {
+      for (int b = 0; b < BUCKETS; b++) {
+        buckets[b] += read(data->histograms[i][b]);
+      }
+    }
+    for (int b = 0; b < BUCKETS; b++) {
+      if (buckets[b]) {
+        last = b + 1;
+      }
+    }
+    // power of two buckets hold values in [2^(b-1), 2^b).
+    os << (i ? "," : "") << "\n    \"" << HISTOGRAM_NAMES[i]
+       << "\": {\"scale\": \""
+       << (HISTOGRAM_LINEAR[i] ? "linear" : "log2") << "\", \"buckets\": [";
+    for (int b = 0; b < last; b++) {
+      os << (b ? ", " : "") << buckets[b];
+    }
+    os << "]}";
+  }
+  os << "\n  }\n}\n";
+}
+
+static struct {
+  std::mutex lock;
+  std::condition_variable stop;
+  bool stopping = false;
+  std::thread thread;
+} dumper;
+
+void startDumping(const std::string &path, std::chrono::seconds period) {
+  stopDumping();
+  dumper.stopping = false;
+  dumper.thread = std::thread([path, period] {
+    std::unique_lock<std::mutex> guard(dumper.lock);
+    while (true) {
+      bool stopping =
+          dumper.stop.wait_for(guard, period, [] { return dumper.stopping; });
+      std::ofstream file(path);
+      dumpJson(file);
+      if (stopping) {
+        break;
+      }
+    }
+  });
+}
+
+void stopDumping() {
+  if (!dumper.thread.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(dumper.lock);
+    dumper.stopping = true;
+  }
+  dumper.stop.notify_all();
+  dumper.thread.join();
+}
+
+} // namespace instrument
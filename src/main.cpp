@@ -1,64 +1,346 @@
-#include "concurrent_queue.h"
+#include "batch_tuner.h"
 #include "constants.h"
-#include "ctpl.h"
 #include "dnn.h"
+#include "eval_queue.h"
 #include "evaluate.h"
+#include "inference_server.h"
+#include "instrument.h"
 #include "mcts.h"
 #include "move_gen.h"
+#include "multiplex.h"
+#include "policy_index.h"
+#include "scheduler.h"
+#include "shared_ring.h"
+#include "tablebase.h"
 #include <ATen/Context.h>
 #include <c10/core/Device.h>
 #include <c10/core/DeviceType.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstddef>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
 #include <torch/cuda.h>
 #include <torch/torch.h>
 
+// a training sample from a full search. policy holds the root's visit
+// distribution as (policy index, probability) pairs, and value the game
+// result for the side to move, filled in when the game ends.
 struct State {
-  Midnight::Position position;
+  Midnight::SharedPosition position;
+  std::vector<std::pair<int16_t, float>> policy;
   float value;
 };
 
-void playGame(Node *root, DNN &model, GlobalData &g) {
-  while (true) {
-    if (isTerminal(root->position)) {
-      break;
+// the visit distribution over the root's children.
+std::vector<std::pair<int16_t, float>> visitPolicy(Node *root) {
+  std::vector<std::pair<int16_t, float>> policy;
+  float total = 0;
+  for (const Edge &edge : root->edges) {
+    if (edge.visits > 0) {
+      policy.push_back({policyIndex(edge.move), edge.visits});
+      total += edge.visits;
     }
-    float temperature = 1.0f;
-    Node *selected = getNextMove(root, model, temperature, g);
+  }
+  for (auto &[index, probability] : policy) {
+    probability /= total;
+  }
+  return policy;
+}
 
-    for (Node *node : root->children) {
-      if (node != selected) {
-        delete node;
-      }
+// a self-play game in progress.
+struct Game {
+  Node *root = nullptr;
+  std::vector<State> states;
+  std::vector<int> statePlies; // the ply of each state.
+  int ply = 0;
+  bool full = false; // whether the current move gets a full search.
+};
+
+// self-play uses playout cap randomization: a move gets a full search with
+// FULL_SEARCH_PROBABILITY and is then recorded for training, otherwise a
+// cheap FAST_SIMULATIONS search that only picks the move. full searches skip
+// the early stop so their visit counts stay a usable target.
+void beginMove(Game &game, GlobalData &g) {
+  game.full = rand() / (RAND_MAX + 1.0) < FULL_SEARCH_PROBABILITY;
+  g.limits = SearchLimits();
+  g.limits.simulations = game.full ? SIMULATIONS : FAST_SIMULATIONS;
+  g.limits.earlyStop = !game.full;
+}
+
+// records a full search and moves the root to the selected child, freeing
+// the other subtrees. a root answered by the tablebases has no visits, so
+// its target is the tablebase move; a search with no target is not
+// recorded.
+void endMove(Game &game, Node *selected, GlobalData &g) {
+  Node *root = game.root;
+  if (game.full) {
+    std::vector<std::pair<int16_t, float>> policy = visitPolicy(root);
+    if (policy.empty() && g.tablebaseMove) {
+      policy.push_back({policyIndex(*g.tablebaseMove), 1.0f});
+    }
+    if (!policy.empty()) {
+      game.states.push_back({root->position, std::move(policy), 0});
+      game.statePlies.push_back(game.ply);
     }
-    root->children.clear();
-    root->children.insert(selected);
+  }
 
-    root = selected;
+  game.root = advanceRoot(root, selected, g);
+  game.ply++;
 
-    temperature = std::pow(temperature + 1, TEMPERATURE_DECAY);
+  std::cout << game.root->position << std::endl;
+}
+
+// fills in the game result of every recorded state.
+void endGame(Game &game, GlobalData &g) {
+  Node *root = game.root;
 
-    std::cout << root->position << std::endl;
+  // the result is for the side to move in the final position.
+  float result = terminalValue(root->position);
+  for (size_t i = 0; i < game.states.size(); i++) {
+    game.states[i].value =
+        (game.ply - game.statePlies[i]) % 2 == 0 ? result : -result;
   }
 
   while (root) {
     std::cout << root->position.fen() << std::endl;
     root = root->parent;
   }
+
+  if (g.stats.searches > 0) {
+    std::cout << "early stop saved "
+              << static_cast<double>(g.stats.simulationsSaved) /
+                     g.stats.searches
+              << " simulations per move" << std::endl;
+  }
+  std::cout << game.states.size() << " of " << game.ply
+            << " moves had a full search, " << g.stats.simulations
+            << " simulations in total" << std::endl;
+  std::cout << "tree memory peaked at " << (g.stats.peakTreeBytes >> 20)
+            << " MB, " << g.stats.prunes << " prunes freed "
+            << g.stats.nodesPruned << " nodes" << std::endl;
+}
+
+std::vector<State> playGame(Node *root, DNN &model, GlobalData &g) {
+  Game game;
+  game.root = root;
+
+  while (true) {
+    if (isTerminal(game.root->position)) {
+      break;
+    }
+    float temperature = 1.0f;
+    beginMove(game, g);
+    Node *selected = getNextMove(game.root, model, temperature, g);
+    // a game cut off without its inference server has no result.
+    if (selected == nullptr) {
+      return {};
+    }
+    endMove(game, selected, g);
+
+    temperature = std::pow(temperature + 1, TEMPERATURE_DECAY);
+  }
+
+  endGame(game, g);
+  return game.states;
+}
+
+// playGame as a coroutine that suspends for every network evaluation, so
+// one thread can drive many games and batch their leaves together.
+SearchTask playGameMultiplexed(Game &game, GlobalData &g,
+                               BatchEvaluator &evaluator) {
+  while (!isTerminal(game.root->position)) {
+    float temperature = 1.0f;
+    beginMove(game, g);
+
+    startSearch(game.root, g);
+    while (!searchDone(game.root, g)) {
+      if (gatherBatch(game.root, g)) {
+        Eval outputs = co_await evaluator.evaluate(encodeBatch(g));
+        backupBatch(outputs, g);
+      }
+    }
+    endMove(game, finishSearch(game.root, temperature, g), g);
+  }
+
+  endGame(game, g);
 }
 
 Node *createRoot() {
-  Node *root = new Node(nullptr, {}, Midnight::Position(Midnight::START_FEN));
+  Node *root =
+      new Node(nullptr, Midnight::SharedPosition(Midnight::START_FEN));
   return root;
 }
 
 
-int main() {
-  ctpl::thread_pool pool(PARALLEL_GAMES);
-  std::array<GlobalData*, PARALLEL_GAMES> globalData;
-  moodycamel::ConcurrentQueue<Node*> q;
+// plays the given number of self-play games at once on the calling thread.
+void playMultiplexed(int games) {
+  torch::Device device = torch::kCPU;
+  if (torch::cuda::is_available()) {
+    device = torch::Device(torch::kCUDA, 0);
+  }
+  DNN model = DNN();
+  torch::NoGradGuard no_grad;
+  model->to(device);
+
+  // one thread runs every forward pass, so the games split the tuned batch
+  // between them and the evaluator never runs more than it at once.
+  games = std::max(games, 1);
+  size_t forwardBatch = MAX_BATCH_SIZE;
+  size_t gameBatch = BATCH_SIZE;
+  if (AUTOTUNE_BATCH) {
+    forwardBatch = tuneBatchSize(model, device);
+    gameBatch = std::max<size_t>(forwardBatch / games, 1);
+    std::cout << "batch size " << forwardBatch << " per forward pass, "
+              << gameBatch << " per game" << std::endl;
+  }
+  BatchEvaluator evaluator(model, device, forwardBatch);
+
+  // tasks hold references into these, so they are sized once.
+  std::vector<Game> states(games);
+  std::vector<GlobalData> data(games, GlobalData(torch::kCPU, nullptr));
+  std::vector<SearchTask> tasks;
+  for (int i = 0; i < games; i++) {
+    data[i].batchSize = gameBatch;
+    states[i].root = createRoot();
+    states[i].root->threadIndex = i;
+    tasks.push_back(playGameMultiplexed(states[i], data[i], evaluator));
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  runTasks(tasks, evaluator);
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  std::cout << games << " games in " << seconds << " s, "
+            << evaluator.forwardPasses << " forward passes of "
+            << static_cast<double>(evaluator.positions) /
+                   std::max<uint64_t>(evaluator.forwardPasses, 1)
+            << " positions on average" << std::endl;
+}
+
+// runs the network for clients search processes over the shared memory
+// ring name until all of them have detached.
+int serve(const std::string &name, uint32_t clients) {
+  SharedRing ring;
+  if (!ring.create(name, clients)) {
+    return 1;
+  }
+  torch::Device device = torch::kCPU;
+  if (torch::cuda::is_available()) {
+    device = torch::Device(torch::kCUDA, 0);
+  }
+  DNN model = DNN();
+  model->to(device);
+
+  std::cout << "serving " << clients << " clients on " << name << std::endl;
+  ServerStats stats = serveInference(ring, model, device);
+  std::cout << stats.forwardPasses << " forward passes of "
+            << static_cast<double>(stats.positions) /
+                   std::max<uint64_t>(stats.forwardPasses, 1)
+            << " positions on average, " << stats.inferenceTime
+            << " s inferring" << std::endl;
+  return 0;
+}
+
+// plays games self-play games one after another as client of the ring
+// name. the process never loads the network.
+int playRemote(const std::string &name, uint32_t client, int games) {
+  SharedRing ring;
+  if (!ring.open(name) || client >= ring.header().clients) {
+    return 1;
+  }
+  RingClient remote(ring, client);
+  if (!remote.attached()) {
+    return 1;
+  }
+
+  DNN model = nullptr;
+  for (int i = 0; i < games; i++) {
+    GlobalData g = GlobalData(torch::kCPU, nullptr);
+    g.remote = &remote;
+    g.batchSize = std::min<size_t>(BATCH_SIZE, RING_LEAVES);
+    Node *root = createRoot();
+    root->threadIndex = client;
+    playGame(root, model, g);
+    if (remote.lost()) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// usage: main, or main multiplex <games> to drive that many games from one
+// thread with coroutines. main serve <ring> <clients> runs only the network
+// for main client <ring> <index> [games] processes, which only search.
+// ring names start with a slash, as in /chess.
+int main(int argc, char **argv) {
+#ifdef INSTRUMENT
+  instrument::startDumping("instrument.json", std::chrono::seconds(10));
+#endif
+  if (const char *path = std::getenv("SYZYGY_PATH")) {
+    initTablebases(path);
+  }
+  if (argc > 3 && (std::string(argv[1]) == "serve" ||
+                   std::string(argv[1]) == "client")) {
+    int status = std::string(argv[1]) == "serve"
+                     ? serve(argv[2], std::atoi(argv[3]))
+                     : playRemote(argv[2], std::atoi(argv[3]),
+                                  argc > 4 ? std::atoi(argv[4]) : 1);
+#ifdef INSTRUMENT
+    instrument::stopDumping();
+#endif
+    return status;
+  }
+  if (argc > 2 && std::string(argv[1]) == "multiplex") {
+    playMultiplexed(std::atoi(argv[2]));
+#ifdef INSTRUMENT
+    instrument::stopDumping();
+#endif
+    return 0;
+  }
+
+  // the games run as tasks on the shared scheduler, whose other workers
+  // steal the games' encoding and expansion chunks.
+  Scheduler &scheduler = defaultScheduler();
 
+  // with a gpu one forward pass serves every game, so each game gathers its
+  // share of the tuned batch. on the cpu every game running at once makes
+  // its own passes, so the sweep runs that many at once too. gatherBatch
+  // further caps a game's batch by its simulation budget.
+  size_t forwardBatch = PARALLEL_GAMES * BATCH_SIZE;
+  size_t gameBatch = BATCH_SIZE;
+  if (AUTOTUNE_BATCH) {
+    torch::Device device = torch::cuda::is_available()
+                               ? torch::Device(torch::kCUDA, 0)
+                               : torch::Device(torch::kCPU);
+    DNN model = DNN();
+    model->to(device);
+    // the workers and the main thread run games.
+    int concurrency =
+        device.is_cuda()
+            ? 1
+            : std::min<int>(PARALLEL_GAMES, scheduler.size() + 1);
+    forwardBatch = tuneBatchSize(model, device, concurrency);
+    gameBatch = device.is_cuda()
+                    ? std::max<size_t>(forwardBatch / PARALLEL_GAMES, 1)
+                    : forwardBatch;
+    std::cout << "batch size " << forwardBatch << " per forward pass, "
+              << gameBatch << " per game" << std::endl;
+  }
+
+  // the gpu evaluator takes a batch once every game has queued one or
+  // EVAL_MAX_WAIT_US after the first leaf, whichever comes first.
+  EvalQueue q(forwardBatch, std::chrono::microseconds(EVAL_MAX_WAIT_US));
+
+  std::atomic<int64_t> running = PARALLEL_GAMES;
+  std::vector<FunctionTask> games;
   for (size_t i = 0; i < PARALLEL_GAMES; i++) {
-    pool.push([i, &q, &globalData](int) {
+    games.emplace_back([i, &q, gameBatch](int) {
       Node *root = createRoot();
       
       torch::Device device = torch::kCPU;
@@ -67,27 +349,34 @@ int main() {
       }
 
       GlobalData g = GlobalData(device, &q);
-      globalData[i] = &g;
+      g.batchSize = gameBatch;
 
       DNN model = DNN();
       torch::NoGradGuard no_grad;
       model->to(device);
       root->threadIndex = i;
       playGame(root, model, g);
-    });
+    }, &running);
   }
+  scheduler.spawn(games.data(), games.size());
 
   #if HAS_CUDA
   DNN model = DNN();
   model->to(torch::kCUDA);
   std::thread evaluateThread = std::thread([&](){
-    while (pool.n_idle() != PARALLEL_GAMES) {
-      evaluate(q, model, globalData);
-      std::this_thread::sleep_for(std::chrono::nanoseconds(10000));
+    while (running.load() > 0) {
+      evaluate(q, model);
     }
   });
+  #endif
+  // the main thread plays games too until none are left to start.
+  scheduler.wait(running, true);
+  #if HAS_CUDA
   evaluateThread.join();
   #endif
 
+#ifdef INSTRUMENT
+  instrument::stopDumping();
+#endif
   return 0;
 }
\ No newline at end of file
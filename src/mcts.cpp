@@ -1,21 +1,48 @@
 #include "mcts.h"
 #include "constants.h"
 #include "create_state.h"
+#include "create_state_fast.h"
 #include "dnn.h"
+#include "instrument.h"
 #include "move_gen.h"
+#include "moves.h"
+#include "policy_index.h"
+#include "scheduler.h"
+#include "tablebase.h"
 #include <ATen/core/interned_strings.h>
 #include <ATen/ops/zero.h>
 #include <algorithm>
+#include <chrono>
 #include <c10/core/DeviceType.h>
 #include <cassert>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
-#ifdef HAS_CUDA
-#include "create_state_fast.h"
-#endif
+
+// leaves expanded per scheduler task in putBatch.
+constexpr int64_t EXPANSION_GRAIN = 8;
+
+// returns the seconds elapsed since start.
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+// spins until the node's child lock is acquired.
+static void lockChildren(Node *node) {
+  uint64_t spins = 0;
+  while (!node->childLock.try_lock()) {
+    spins++;
+  }
+  INSTRUMENT_COUNT(LOCK_ACQUIRES, 1);
+  INSTRUMENT_COUNT(LOCK_SPINS, spins);
+}
 
 struct Statistics {
   float *totalValue;
@@ -38,33 +65,8 @@ Statistics getTreeStats(Node *node, bool isBatch, GlobalData &g) {
   }
 }
 
-// creates a vector of Move with some hacks to get aorund templates.
-std::vector<Midnight::Move> createMovelistVec(Midnight::Position board) {
-  const Midnight::Move *begin;
-  const Midnight::Move *end;
-  if (board.turn() == Midnight::WHITE) {
-    Midnight::MoveList<Midnight::WHITE> movelist(board);
-    begin = movelist.begin();
-    end = movelist.end();
-  } else {
-    Midnight::MoveList<Midnight::BLACK> movelist(board);
-    begin = movelist.begin();
-    end = movelist.end();
-  }
-
-  return std::vector<Midnight::Move>(begin, end);
-}
-
-void playMove(Midnight::Position &board, const Midnight::Move move) {
-  if (board.turn() == WHITE) {
-    board.play<WHITE>(move);
-  } else {
-    board.play<BLACK>(move);
-  }
-}
-
 // checks whether the position has insufficient material.
-bool insufficientMaterial(Midnight::Position &board) {
+bool insufficientMaterial(Midnight::SharedPosition &board) {
   for (Midnight::PieceType pieceType :
        {Midnight::PAWN, Midnight::ROOK, Midnight::QUEEN}) {
     for (Midnight::Color color : {Midnight::WHITE, Midnight::BLACK}) {
@@ -103,12 +105,10 @@ bool insufficientMaterial(Midnight::Position &board) {
   return false;
 }
 
-// check if the board state is terminal
-bool isTerminal(Midnight::Position &board) {
-  std::vector<Midnight::Move> movelist = createMovelistVec(board);
-
-  if (movelist.size() == 0 ||
-      board.has_repetition(Midnight::Position::THREE_FOLD) ||
+// check if the board state is terminal. repetitions is how many times the
+// position occurred before on the game path.
+bool isTerminal(Midnight::SharedPosition &board, int repetitions) {
+  if (!hasLegalMove(board) || repetitions >= 2 ||
       board.fifty_move_rule() >= 100)
     return true;
 
@@ -118,12 +118,18 @@ bool isTerminal(Midnight::Position &board) {
   return false;
 }
 
+bool isTerminal(Midnight::SharedPosition &board) {
+  int repetitions =
+      board.has_repetition(Midnight::SharedPosition::THREE_FOLD) ? 2 : 0;
+  return isTerminal(board, repetitions);
+}
+
 // returns the board state's terminal value if board is terminal.
-float terminalValue(Midnight::Position &board) {
+float terminalValue(Midnight::SharedPosition &board, int repetitions) {
   uint64_t whiteKingBoard = board.pieces[Midnight::WHITE_KING];
   uint64_t blackKingBoard = board.pieces[Midnight::BLACK_KING];
 
-  if (createMovelistVec(board).size() == 0) {
+  if (!hasLegalMove(board)) {
     if (board.turn() == Midnight::WHITE &&
         board.attackers_of<Midnight::BLACK>(
             Midnight::Square(__builtin_ctzll(whiteKingBoard)),
@@ -139,8 +145,8 @@ float terminalValue(Midnight::Position &board) {
     }
   }
 
-  if (board.has_repetition(Midnight::Position::THREE_FOLD) ||
-      board.fifty_move_rule() >= 100 || insufficientMaterial(board)) {
+  if (repetitions >= 2 || board.fifty_move_rule() >= 100 ||
+      insufficientMaterial(board)) {
     return 0.0f;
   }
 
@@ -148,246 +154,1061 @@ float terminalValue(Midnight::Position &board) {
   return 0.0f;
 }
 
-static const int KDX[8] = {1, 2, 2, 1, -1, -2, -2, -1};
-static const int KDY[8] = {2, 1, -1, -2, -2, -1, 1, 2};
+float terminalValue(Midnight::SharedPosition &board) {
+  int repetitions =
+      board.has_repetition(Midnight::SharedPosition::THREE_FOLD) ? 2 : 0;
+  return terminalValue(board, repetitions);
+}
 
-// returns the index for the policy tensor that corresponds to a move on the
-// board.
-float policyIndex(Position &board, Move move) {
-  Piece piece = board.piece_at(move.from());
-  PieceType pieceType = static_cast<PieceType>(piece % 8);
-  int diffx = move.to() % 8 - move.from() % 8;
-  int diffy = move.to() / 8 - move.from() / 8;
-  int moveType = 0;
+// adds virtual visits to a node on a path in the current batch, so later
+// descents of the batch lean towards other lines. the visits carry the
+// node's current mean and disappear when the next batch resets its stats.
+void addVirtualVisit(Node *node, uint32_t visits, GlobalData &g) {
+  Statistics stats = getTreeStats(node, true, g);
+  float mean = FPU;
+  if (*stats.visitCount > 0) {
+    mean = *stats.totalValue / *stats.visitCount;
+  }
 
-  if (pieceType == KNIGHT) {
-    for (int i = 0;; i++) {
-      if (diffx == KDX[i] && diffy == KDY[i]) {
-        moveType = 56 + i;
-        break;
-      }
-    }
-  } else {
-    int distance = std::max(abs(diffx), abs(diffy)) - 1;
-    int direction = (diffx == 0  ? 0
-                     : diffx > 0 ? 1
-                                 : 2) +
-                    3 * (diffy == 0  ? 0
-                         : diffy > 0 ? 1
-                                     : 2);
-    if (move.is_promotion() && ((move.type() & 0b0111) != PR_QUEEN)) {
-      moveType = 64 + (move.type() & 0b0011) * 3 + direction - 3;
-    } else {
-      moveType = direction * 7 + distance;
+  *stats.totalValue += visits * VL * mean;
+  *stats.visitCount += visits * VL;
+}
+
+// the edge from node to one of its children.
+static Edge &edgeTo(Node *node, Node *child) {
+  for (Edge &edge : node->edges) {
+    if (edge.child == child) {
+      return edge;
     }
   }
+  assert(false);
+  return node->edges.front();
+}
 
-  return move.from() * 73 + moveType;
+// adds a leaf's value to every node on its path. value is for the side to
+// move at the leaf, and each node keeps its total for the side that moved
+// into it, which is the side choosing it in selection.
+void backup(const Visit &visit, float value) {
+  for (size_t i = visit.path.size(); i-- > 0;) {
+    Node *node = visit.path[i];
+    value = -value;
+    node->totalValue += value * visit.multiplicity;
+    node->visitCount += visit.multiplicity;
+    if (i > 0) {
+      edgeTo(visit.path[i - 1], node).visits += visit.multiplicity;
+    }
+  }
 }
 
-void updateStatistics(float res, Node *node, Node *childNode, bool batch,
-                      GlobalData &g) {
-  Statistics parentStats = getTreeStats(node, batch, g);
-  Statistics childStats = getTreeStats(childNode, batch, g);
+// backup for graph search, where a node's children also collect visits
+// from their other parents, so a running total over this path would drift
+// from what the children report. each node on the path instead recomputes
+// its mean from its own evaluation and its children's current means,
+// weighted by the visits of the edge to each.
+void backupGraph(const Visit &visit, float value) {
+  Node *leaf = visit.path.back();
+  leaf->totalValue += -value * visit.multiplicity;
+  leaf->visitCount += visit.multiplicity;
 
-  if (res != UNKNOWN) {
-    *parentStats.totalValue += res;
-    *parentStats.visitCount += 1;
-    *childStats.totalValue += res;
-    *childStats.visitCount += 1;
+  for (size_t i = visit.path.size() - 1; i-- > 0;) {
+    Node *node = visit.path[i];
+    edgeTo(node, visit.path[i + 1]).visits += visit.multiplicity;
+    node->visitCount += visit.multiplicity;
+
+    uint32_t childVisits = 0;
+    float total = 0;
+    // a pruned edge keeps its visits but lost its child's mean, so they
+    // count at the node's own value until the child is searched again.
+    for (Edge &edge : node->edges) {
+      if (edge.visits > 0 && edge.child != nullptr &&
+          edge.child->visitCount > 0) {
+        childVisits += edge.visits;
+        total -= edge.visits * edge.child->totalValue / edge.child->visitCount;
+      }
+    }
+    uint32_t own = node->visitCount - childVisits;
+    if (own > 0) {
+      float ownValue = node->provenValue != UNKNOWN ? node->provenValue
+                                                    : -node->valueEval;
+      total += own * ownValue;
+    }
+    node->totalValue = total;
   }
 }
 
-void updateStatisticsGet(float res, Node *node, Node *childNode, bool batch,
-                         GlobalData &g) {
-  if (res == UNKNOWN) {
-    Statistics parentStats = getTreeStats(node, batch, g);
-    Statistics childStats = getTreeStats(childNode, batch, g);
-    float mean;
-    if (*childStats.visitCount == 0) {
-      mean = FPU;
+// proves a node once its children decide it: a child that is a proven win
+// for the side to move wins the node, and otherwise the node takes its best
+// child's value once every move is proven. returns whether node was proven.
+static bool proveNode(Node *node) {
+  if (!node->initialized || node->provenValue != UNKNOWN) {
+    return false;
+  }
+
+  float best = -INFINITY;
+  bool complete = !node->edges.empty();
+  lockChildren(node);
+  for (Edge &edge : node->edges) {
+    if (edge.child == nullptr || edge.child->provenValue == UNKNOWN) {
+      complete = false;
     } else {
-      mean = *childStats.totalValue / *childStats.visitCount;
+      best = std::max(best, edge.child->provenValue);
     }
+  }
+  node->childLock.unlock();
 
-    *childStats.totalValue += VL * mean;
-    *childStats.visitCount += VL;
-    *parentStats.totalValue += VL * mean;
-    *parentStats.visitCount += VL;
-  } else {
-    updateStatistics(res, node, childNode, batch, g);
+  if (best == 1 || complete) {
+    node->provenValue = -best;
+    return true;
+  }
+  return false;
+}
+
+// carries a proven leaf's result up its path until a node stays unproven.
+void proveAncestors(const Visit &visit) {
+  for (auto node = visit.path.rbegin() + 1; node != visit.path.rend();
+       node++) {
+    if (!proveNode(*node)) {
+      break;
+    }
   }
 }
 
-float batchPUCT(Node *node, bool getBatch, GlobalData &g) {
-  Batch &batch = g.batch;
-  if (isTerminal(node->position)) {
-    return terminalValue(node->position);
+// seeds the repetition tracker with the game path from the root's last
+// irreversible move up to the root, oldest first.
+void seedRepetitions(Node *root, GlobalData &g) {
+  std::vector<uint64_t> keys;
+  const Node *current = root;
+  for (int ply = 0; current && ply <= root->position.fifty_move_rule();
+       ply++) {
+    keys.push_back(current->position.hash());
+    current = current->parent;
+  }
+
+  g.repetitions.clear();
+  for (auto key = keys.rbegin(); key != keys.rend(); key++) {
+    g.repetitions.push(*key);
   }
+}
 
-  if (!node->initialized) {
-    if (getBatch) {
-      batch.nodes.push_back(node);
-      if (g.device == torch::kCPU) {
-        batch.nnInputs.push_back(createState(constructHistory(node), g.device));
+// the heap memory of a node and its edges.
+static uint64_t nodeBytes(const Node *node) {
+  return sizeof(Node) + node->edges.capacity() * sizeof(Edge);
+}
+
+// the memory of node and every node it owns, which deleting node frees.
+static uint64_t ownedBytes(Node *node) {
+  uint64_t bytes = 0;
+  std::vector<Node *> stack = {node};
+  while (!stack.empty()) {
+    Node *current = stack.back();
+    stack.pop_back();
+    bytes += nodeBytes(current);
+    for (Edge &edge : current->edges) {
+      if (edge.owner) {
+        stack.push_back(edge.child);
       }
-    } else if (node->valueEval != INFINITY) {
-      node->initialized = true;
-      return node->valueEval;
     }
-    return UNKNOWN;
   }
+  return bytes;
+}
 
-  float bestScore = -INFINITY;
-  Node *selected = nullptr;
+// the graph search key of a position reached with the given repetition
+// count. the count is part of the key because it changes the network input
+// and whether the position is a draw.
+static uint64_t graphKey(uint64_t hash, int repetitions) {
+  return hash ^ (repetitions * 0x9e3779b97f4a7c15ULL);
+}
 
-  while (true) {
-    if (node->childLock.try_lock()) {
-      break;
+// allocates the child node of an edge that has none, or in graph search
+// links the edge to the node already holding that position. the caller
+// holds the parent's child lock and the repetition tracker holds the path
+// to node.
+void createChild(Node *node, Edge &edge, GlobalData &g) {
+  if (edge.child != nullptr) {
+    return;
+  }
+  Midnight::SharedPosition newBoard(node->position);
+  playMove(newBoard, edge.move);
+
+  Node **shared = nullptr;
+  if (g.graph) {
+    int repetitions =
+        std::min<uint32_t>(g.repetitions.count(newBoard.hash()), 2);
+    shared = &g.transpositions[graphKey(newBoard.hash(), repetitions)];
+    if (*shared != nullptr) {
+      edge.child = *shared;
+      g.stats.transpositions += 1;
+      return;
     }
   }
 
-  for (Node *childNode : node->children) {
-    Statistics childStats = getTreeStats(childNode, getBatch, g);
-    Statistics nodeStats = getTreeStats(node, getBatch, g);
+  edge.child = new Node(node, newBoard);
+  edge.owner = true;
+  edge.child->threadIndex = node->threadIndex;
+  g.stats.nodesAllocated += 1;
+  g.treeBytes += sizeof(Node);
+  if (shared != nullptr) {
+    *shared = edge.child;
+  }
+}
+
+// the edge of move, added if the node was never expanded. the caller holds
+// the node's child lock.
+static Edge &edgeFor(Node *node, Midnight::Move move) {
+  for (Edge &edge : node->edges) {
+    if (edge.move == move) {
+      return edge;
+    }
+  }
+  node->edges.push_back({move, 1.0f});
+  return node->edges.back();
+}
+
+// the child reached by move, adding an edge if the node was never expanded.
+// the caller holds the node's child lock.
+Node *childFor(Node *node, Midnight::Move move, GlobalData &g) {
+  Edge &edge = edgeFor(node, move);
+  createChild(node, edge, g);
+  return edge.child;
+}
+
+// picks the child with the best PUCT score over the batch stats, creating
+// its node if the edge was never visited. proven children score their exact
+// value, and a proven win is taken outright.
+Node *selectChild(Node *node, GlobalData &g) {
+  float bestScore = -INFINITY;
+  Edge *best = nullptr;
+
+  lockChildren(node);
+
+  Statistics nodeStats = getTreeStats(node, true, g);
+  for (Edge &edge : node->edges) {
     float mean = FPU;
+    uint32_t visitCount = edge.visits;
 
-    if (*childStats.visitCount > 0) {
-      mean = *childStats.totalValue / *childStats.visitCount;
+    if (edge.child != nullptr) {
+      if (edge.child->provenValue == 1) {
+        best = &edge;
+        break;
+      }
+      // in a graph the child's stats include visits from every parent.
+      // they all estimate the child's value, so the mean is over all of
+      // them, while exploration counts only this edge's visits plus the
+      // child's virtual visits.
+      Statistics childStats = getTreeStats(edge.child, true, g);
+      visitCount += *childStats.visitCount - edge.child->visitCount;
+      if (edge.child->provenValue != UNKNOWN) {
+        mean = edge.child->provenValue;
+      } else if (*childStats.visitCount > 0) {
+        mean = *childStats.totalValue / *childStats.visitCount;
+      }
     }
-    // std::cout << mean << " " << childNode->policyEval << " " <<
-    // *nodeStats.visitCount << " " << *childStats.visitCount << " " <<
-    // *childStats.totalValue << std::endl;
-    float bandit = mean + C_PUCT * childNode->policyEval *
-                              (sqrtf(*nodeStats.visitCount) /
-                               (1 + *childStats.visitCount));
+    float bandit = mean + C_PUCT * edge.prior *
+                              (sqrtf(*nodeStats.visitCount) / (1 + visitCount));
 
     if (bandit > bestScore) {
       bestScore = bandit;
-      selected = childNode;
+      best = &edge;
     }
   }
 
+  createChild(node, *best, g);
+  Node *selected = best->child;
+
   node->childLock.unlock();
+  return selected;
+}
 
-  float res = batchPUCT(selected, getBatch, g);
+// descends from the root to an unevaluated or proven leaf and adds a
+// virtual visit along the path. hitting a leaf that is already in the batch
+// along the same path adds to that visit's multiplicity instead of a new
+// entry. in a graph the leaf can also be reached along another path, which
+// gets its own visit but no second evaluation. returns false on either
+// collision.
+bool gatherLeaf(Node *root, GlobalData &g) {
+  Batch &batch = g.batch;
+  Visit visit;
+  Node *node = root;
+
+  while (true) {
+    visit.path.push_back(node);
 
-  updateStatisticsGet(res, node, selected, getBatch, g);
-  if (res != UNKNOWN) {
-    return -res;
+    // the path to a node never changes, so its repetition count, input
+    // planes and terminal or tablebase result are computed once on the
+    // first visit. the root is searched by probeRoot instead.
+    if (node->repetitions < 0) {
+      node->repetitions = std::min<uint32_t>(
+          g.repetitions.count(node->position.hash()) - 1, 2);
+      node->planes = encodePlanes(node->position, node->repetitions);
+      float value;
+      if (isTerminal(node->position, node->repetitions)) {
+        node->provenValue = -terminalValue(node->position, node->repetitions);
+      } else if (node != root && probeWDL(node->position, value)) {
+        node->provenValue = -value;
+        g.stats.tablebaseHits += 1;
+        INSTRUMENT_COUNT(TABLEBASE_HITS, 1);
+      }
+    }
+    // a proven node is scored exactly and its subtree is not searched. the
+    // root still needs its children unless it is terminal.
+    if (node->provenValue != UNKNOWN &&
+        (node != root || !node->initialized)) {
+      visit.value = -node->provenValue;
+      break;
+    }
+    // a transposition can lead back onto the path, where the node's own
+    // repetition count is stale. the path's count still ends the line.
+    if (g.graph && node != root &&
+        g.repetitions.count(node->position.hash()) > 2) {
+      visit.value = 0;
+      break;
+    }
+    if (!node->initialized) {
+      break;
+    }
+
+    node = selectChild(node, g);
+    g.repetitions.push(node->position.hash());
+  }
+
+  for (size_t i = 1; i < visit.path.size(); i++) {
+    g.repetitions.pop();
   }
-  return UNKNOWN;
+  INSTRUMENT_RECORD(SELECTION_DEPTH, visit.path.size() - 1);
+
+  for (Node *pathNode : visit.path) {
+    addVirtualVisit(pathNode, 1, g);
+  }
+
+  bool batched = false;
+  for (Visit &other : batch.visits) {
+    if (other.path.back() == node) {
+      if (other.path == visit.path) {
+        other.multiplicity += 1;
+        return false;
+      }
+      batched = true;
+    }
+  }
+
+  if (visit.value == UNKNOWN && !batched) {
+    batch.nodes.push_back(node);
+  }
+  batch.visits.push_back(std::move(visit));
+  return !batched;
 }
 
-void getBatch(Node *node, GlobalData &g) {
+// gathers leaves until the batch holds target distinct leaves for the
+// network or the descents have collided COLLISION_BUDGET times.
+void getBatch(Node *root, GlobalData &g, size_t target) {
+  INSTRUMENT_TIMER(GET_BATCH);
   Batch &batch = g.batch;
 
-  for (int i = 0; i < 32; i++) {
-    batchPUCT(node, true, g);
-    if (batch.nodes.size() >= 2 &&
-        batch.nodes[batch.nodes.size() - 1]->position.hash() ==
-            batch.nodes[batch.nodes.size() - 2]->position.hash()) {
-      batch.nodes.pop_back();
-      if (g.device == torch::kCPU) {
-        batch.nnInputs.pop_back();
-      }
-      break;
+  // batch stats restart from the real stats, dropping the last batch's
+  // virtual visits.
+  g.currBatchNum += 1;
+
+  int collisions = 0;
+  while (batch.nodes.size() < target && collisions < COLLISION_BUDGET) {
+    g.stats.simulations += 1;
+    INSTRUMENT_COUNT(SIMULATIONS, 1);
+    if (!gatherLeaf(root, g)) {
+      collisions += 1;
+      g.stats.collisions += 1;
+      INSTRUMENT_COUNT(COLLISIONS, 1);
     }
   }
 }
 
-void putBatch(Node *node, Eval &outputs, GlobalData &g) {
+void putBatch(Eval &outputs, GlobalData &g) {
+  INSTRUMENT_TIMER(PUT_BATCH);
   Batch &batch = g.batch;
   std::vector<Node *> &nodes = batch.nodes;
 
-  for (size_t i = 0; i < nodes.size(); i++) {
-    while (true) {
-      if (nodes[i]->childLock.try_lock()) {
-        break;
-      }
-    }
-    for (Move move : createMovelistVec(nodes[i]->position)) {
-      Midnight::Position newBoard(nodes[i]->position);
-      playMove(newBoard, move);
+  if (!nodes.empty()) {
+    torch::Tensor policy = outputs.policy.to(torch::kCPU).contiguous();
+    torch::Tensor value = outputs.value.to(torch::kCPU).contiguous();
+    const float *policyPtr = policy.data_ptr<float>();
+    const float *valuePtr = value.data_ptr<float>();
+
+    // the leaves are distinct, so they are expanded in parallel and the
+    // shared counters are summed afterwards.
+    std::vector<LegalPolicy> legal(nodes.size());
+    std::vector<uint64_t> edgeBytes(nodes.size());
+    defaultScheduler().parallelFor(
+        0, nodes.size(), EXPANSION_GRAIN, [&](int64_t begin, int64_t end) {
+          for (int64_t i = begin; i < end; i++) {
+            legalPolicy(nodes[i]->position, legal[i]);
 
-      Node *childNode =
-          new Node(nodes[i], {}, newBoard,
-                   outputs.policy[i][policyIndex(nodes[i]->position, move)]
-                       .item()
-                       .toFloat());
-      childNode->threadIndex = nodes[i]->threadIndex;
+            // priors are the policy softmax over the legal moves only.
+            std::array<float, 218> priors;
+            legalPriors(policyPtr + i * POLICY_SIZE, legal[i], priors.data());
 
-      nodes[i]->children.insert(childNode);
+            lockChildren(nodes[i]);
+            size_t capacity = nodes[i]->edges.capacity();
+            nodes[i]->edges.reserve(legal[i].moves.size());
+            for (size_t j = 0; j < legal[i].moves.size(); j++) {
+              nodes[i]->edges.push_back({legal[i].moves[j], priors[j]});
+            }
+            edgeBytes[i] =
+                (nodes[i]->edges.capacity() - capacity) * sizeof(Edge);
+
+            nodes[i]->valueEval = valuePtr[i];
+            nodes[i]->initialized = true;
+            nodes[i]->childLock.unlock();
+          }
+        });
+
+    for (size_t i = 0; i < nodes.size(); i++) {
+      g.stats.edges += legal[i].moves.size();
+      g.treeBytes += edgeBytes[i];
     }
+  }
 
-    nodes[i]->valueEval = outputs.value[i].item().toFloat();
-    nodes[i]->childLock.unlock();
+  for (Visit &visit : batch.visits) {
+    Node *leaf = visit.path.back();
+    float value = visit.value != UNKNOWN ? visit.value : leaf->valueEval;
+    if (g.graph) {
+      backupGraph(visit, value);
+    } else {
+      backup(visit, value);
+    }
+    if (visit.value != UNKNOWN) {
+      proveAncestors(visit);
+    }
+    g.simulation += visit.multiplicity;
   }
 
-  while (true) {
-    float result = batchPUCT(node, false, g);
+  batch.nodes = {};
+  batch.visits = {};
+}
 
-    if (result == UNKNOWN) {
-      break;
+// whether the most visited root child stays ahead even if every remaining
+// simulation went to the runner-up.
+static bool leaderDecided(Node *root, uint32_t remaining, uint32_t margin) {
+  uint32_t first = 0;
+  uint32_t second = 0;
+
+  lockChildren(root);
+  for (Edge &edge : root->edges) {
+    uint32_t visits = edge.visits;
+    if (visits > first) {
+      second = first;
+      first = visits;
+    } else if (visits > second) {
+      second = visits;
     }
   }
+  root->childLock.unlock();
+
+  return first > second + remaining + margin;
 }
 
-Node *getNextMove(Node *node, DNN &model, float temperature, GlobalData &g) {
-  Batch &batch = g.batch;
+void startSearch(Node *node, GlobalData &g) {
+  g.stats.searches += 1;
+  g.simulation = 0;
+  g.searchStart = std::chrono::steady_clock::now();
+  g.searchBatches = 0;
+  seedRepetitions(node, g);
 
-  while (g.simulation < SIMULATIONS) {
-    getBatch(node, g);
-    if (batch.nodes.size() == 0) {
-      continue;
-    }
+  // a root in the tablebases needs no search.
+  Midnight::Move move;
+  float value;
+  g.tablebaseMove.reset();
+  if (probeRoot(node->position, move, value)) {
+    g.tablebaseMove = move;
+    g.stats.tablebaseRootHits += 1;
+  }
+}
 
-    torch::Tensor batchedInput;
-    if (g.device == torch::kCPU) {
-      batchedInput = torch::zeros({static_cast<long>(batch.nnInputs.size()),
-                                   INPUT_PLANES, 8, 8})
-                         .to(g.device);
-      for (size_t j = 0; j < batch.nnInputs.size(); j++) {
-        batchedInput[j] = batch.nnInputs[j].to(g.device);
-      }
-      g.simulation += batch.nodes.size();
+bool searchDone(Node *node, GlobalData &g) {
+  // every evaluation path backs its batch up before the next one, so no
+  // leaves are in flight here and the tree may be pruned.
+  g.stats.peakTreeBytes = std::max(g.stats.peakTreeBytes, g.treeBytes);
+  if (g.treeBytes > g.treeBudget * PRUNE_START &&
+      g.treeBytes > g.pruneFloor) {
+    pruneTree(node, g);
+  }
 
-      Eval outputs = model->forward(batchedInput);
-      putBatch(node, outputs, g);
-    } else {
-      #ifdef HAS_CUDA
-      g.q->enqueue_bulk(g.batch.nodes.begin(), g.batch.nodes.size());
-      #endif
+  // a proven root is decided, whatever the remaining budget.
+  if (g.simulation >= g.limits.simulations || g.tablebaseMove ||
+      (node->initialized && node->provenValue != UNKNOWN)) {
+    return true;
+  }
+
+  // a timed search stops once the next batch would likely overrun, but
+  // only after the root has a visited child to return.
+  double elapsed = secondsSince(g.searchStart);
+  if (node->visitCount >= 2 &&
+      outOfTime(g.limits, elapsed, g.searchBatches)) {
+    return true;
+  }
+  if (g.limits.earlyStop) {
+    uint32_t remaining = remainingSimulations(g.limits, g.simulation, elapsed);
+    if (leaderDecided(node, remaining, g.limits.earlyStopMargin)) {
+      g.stats.simulationsSaved += remaining;
+      return true;
     }
-    batch.nnInputs = {};
-    batch.nodes = {};
   }
+  return false;
+}
 
-  g.currBatchNum += 1;
+bool gatherBatch(Node *node, GlobalData &g) {
+  g.searchBatches += 1;
+
+  // a batch near the whole budget would descend on virtual losses alone,
+  // so it is capped by the budget as well as by g.batchSize.
+  size_t cap = std::max<size_t>(g.limits.simulations * MAX_BATCH_SHARE, 1);
+  auto start = std::chrono::steady_clock::now();
+  getBatch(node, g,
+           std::min<size_t>({g.batchSize, cap,
+                             g.limits.simulations - g.simulation}));
+  g.stats.selectionTime += secondsSince(start);
+
+  // a batch of only terminal leaves needs no forward pass.
+  if (g.batch.nodes.empty()) {
+    Eval outputs = Eval(torch::Tensor(), torch::Tensor());
+    putBatch(outputs, g);
+    return false;
+  }
+  return true;
+}
+
+torch::Tensor encodeBatch(GlobalData &g) {
+  std::vector<Node *> &nodes = g.batch.nodes;
+  auto start = std::chrono::steady_clock::now();
+  torch::Tensor input =
+      createStateFast(nodes.data(), nodes.data() + nodes.size(), g.device);
+  g.stats.nnEvals += nodes.size();
+  g.stats.batches += 1;
+  g.stats.encodingTime += secondsSince(start);
+  INSTRUMENT_COUNT(NN_EVALS, nodes.size());
+  INSTRUMENT_RECORD(BATCH_SIZE, nodes.size());
+  return input;
+}
+
+// encodes the batch straight into slot and has the inference server
+// evaluate it there. the outputs point into slot, which the caller releases
+// after backing them up. returns false if the server is gone.
+static bool evaluateRemote(RingSlot &slot, Eval &outputs, GlobalData &g) {
+  std::vector<Node *> &nodes = g.batch.nodes;
+  assert(nodes.size() <= RING_LEAVES);
+  auto start = std::chrono::steady_clock::now();
+  Node **begin = nodes.data();
+  Node **end = nodes.data() + nodes.size();
+  expandPlanes(constructHistoryFast(begin, end), slot.planes);
+  g.stats.nnEvals += nodes.size();
+  g.stats.batches += 1;
+  g.stats.encodingTime += secondsSince(start);
+  INSTRUMENT_COUNT(NN_EVALS, nodes.size());
+  INSTRUMENT_RECORD(BATCH_SIZE, nodes.size());
+
+  start = std::chrono::steady_clock::now();
+  g.remote->submit(nodes.size());
+  if (!g.remote->wait(slot)) {
+    return false;
+  }
+  g.stats.inferenceTime += secondsSince(start);
+
+  const int64_t size = nodes.size();
+  outputs = Eval(torch::from_blob(slot.value, {size, 1},
+                                  torch::TensorOptions().dtype(torch::kFloat)),
+                 torch::from_blob(slot.policy, {size, POLICY_SIZE},
+                                  torch::TensorOptions().dtype(torch::kFloat)));
+  return true;
+}
+
+// queues the batch for the gpu evaluator thread and waits for its rows.
+// the visits stay in g.batch, so the caller backs the batch up as usual.
+static Eval evaluateQueued(PendingBatch &pending, GlobalData &g) {
+  std::vector<Node *> &nodes = g.batch.nodes;
+  assert(g.q != nullptr);
+  const int64_t size = nodes.size();
+  g.stats.nnEvals += size;
+  g.stats.batches += 1;
+
+  auto start = std::chrono::steady_clock::now();
+  g.q->enqueue(nodes.data(), size, &pending);
+  pending.wait();
+  g.stats.inferenceTime += secondsSince(start);
+
+  return Eval(torch::from_blob(pending.value.data(), {size, 1},
+                               torch::TensorOptions().dtype(torch::kFloat)),
+              torch::from_blob(pending.policy.data(), {size, POLICY_SIZE},
+                               torch::TensorOptions().dtype(torch::kFloat)));
+}
+
+void backupBatch(Eval &outputs, GlobalData &g) {
+  auto start = std::chrono::steady_clock::now();
+  putBatch(outputs, g);
+  g.stats.backupTime += secondsSince(start);
+}
+
+Node *finishSearch(Node *node, float temperature, GlobalData &g) {
   g.simulation = 0;
+  double searchTime = secondsSince(g.searchStart);
+  g.stats.searchTime += searchTime;
+  g.stats.maxSearchTime = std::max(g.stats.maxSearchTime, searchTime);
+  if (g.limits.timed() && searchTime > g.limits.seconds) {
+    g.stats.overruns += 1;
+  }
 
-  while (true) {
-    if (node->childLock.try_lock()) {
-      break;
+  lockChildren(node);
+
+  if (g.tablebaseMove) {
+    Node *child = childFor(node, *g.tablebaseMove, g);
+    node->childLock.unlock();
+    return child;
+  }
+
+  // a proven win is played at once. proven losses are only sampled when
+  // every visited move loses.
+  Node *win = nullptr;
+  uint32_t winVisits = 0;
+  bool allLost = true;
+  for (Edge &edge : node->edges) {
+    if (edge.child == nullptr) {
+      continue;
+    }
+    if (edge.child->provenValue == 1 &&
+        (win == nullptr || edge.visits > winVisits)) {
+      win = edge.child;
+      winVisits = edge.visits;
+    }
+    if (edge.child->provenValue != -1) {
+      allLost = false;
     }
   }
+  if (win != nullptr) {
+    g.stats.provenWins += 1;
+    node->childLock.unlock();
+    return win;
+  }
+  auto weight = [&](const Edge &edge) {
+    if (!allLost && edge.child->provenValue == -1) {
+      return 0.0;
+    }
+    return pow(edge.visits, 1.0 / temperature);
+  };
 
   float total = 0;
-  for (Node *child : node->children) {
-    total += pow(child->visitCount, 1.0 / temperature);
-    std::cout << child->visitCount << std::endl;
+  for (Edge &edge : node->edges) {
+    if (edge.child != nullptr) {
+      total += weight(edge);
+    }
+  }
+
+  // too little weight to sample, as when the only moves not lost have no
+  // visits yet: play the most visited move that may be sampled, or the
+  // highest prior one if no child exists.
+  if (total < 1) {
+    Edge *best = nullptr;
+    for (Edge &edge : node->edges) {
+      if (edge.child == nullptr ||
+          (!allLost && edge.child->provenValue == -1)) {
+        continue;
+      }
+      if (best == nullptr || edge.visits > best->visits) {
+        best = &edge;
+      }
+    }
+    if (best == nullptr) {
+      best = &*std::max_element(
+          node->edges.begin(), node->edges.end(),
+          [](const Edge &a, const Edge &b) { return a.prior < b.prior; });
+    }
+    Node *child = childFor(node, best->move, g);
+    node->childLock.unlock();
+    return child;
   }
+
   int i = rand() % static_cast<int>(total);
   float curr = 0;
 
-  for (Node *child : node->children) {
-    curr += pow(child->visitCount, 1.0 / temperature);
+  for (Edge &edge : node->edges) {
+    if (edge.child == nullptr || weight(edge) == 0) {
+      continue;
+    }
+    curr += weight(edge);
     if (curr >= i) {
-      return child;
+      node->childLock.unlock();
+      return edge.child;
     }
   }
 
   node->childLock.unlock();
 
   assert(false);
-}
\ No newline at end of file
+  return nullptr;
+}
+
+// searches one tree of a root-parallel search, running the network on the
+// calling thread.
+static void searchTree(Node *node, DNN &model, GlobalData &g) {
+  torch::NoGradGuard noGrad;
+  startSearch(node, g);
+  while (!searchDone(node, g)) {
+    if (!gatherBatch(node, g)) {
+      continue;
+    }
+    torch::Tensor input = encodeBatch(g);
+
+    auto start = std::chrono::steady_clock::now();
+    Eval outputs = [&] {
+      INSTRUMENT_LATENCY(INFERENCE, INFERENCE_LATENCY_US);
+      return model->forward(input);
+    }();
+    g.stats.inferenceTime += secondsSince(start);
+
+    backupBatch(outputs, g);
+  }
+}
+
+// adds the root visits of another tree to node's edges. a proof of a root
+// move holds in every tree, since they share the game path.
+static void mergeRoot(Node *node, Node *other, GlobalData &g) {
+  lockChildren(node);
+  for (Edge &source : other->edges) {
+    if (source.visits == 0 || source.child == nullptr) {
+      continue;
+    }
+    Edge &edge = edgeFor(node, source.move);
+    createChild(node, edge, g);
+    edge.visits += source.visits;
+    if (edge.child->provenValue == UNKNOWN) {
+      edge.child->provenValue = source.child->provenValue;
+    }
+  }
+  node->childLock.unlock();
+}
+
+Node *getNextMoveRootParallel(Node *node, std::vector<DNN> &models,
+                              float temperature, GlobalData &g) {
+  INSTRUMENT_TIMER(GET_NEXT_MOVE);
+  const size_t workers = models.size() - 1;
+
+  // the extra trees share nothing with node but its ancestors, which are
+  // only read for history and repetitions.
+  std::vector<Node *> roots;
+  std::vector<GlobalData> data;
+  data.reserve(workers);
+  for (size_t i = 0; i < workers; i++) {
+    roots.push_back(new Node(node->parent, node->position));
+    roots.back()->threadIndex = node->threadIndex;
+    data.emplace_back(g.device, g.q);
+    data.back().limits = g.limits;
+    data.back().graph = g.graph;
+    data.back().batchSize = g.batchSize;
+  }
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < workers; i++) {
+    threads.emplace_back(
+        [&, i] { searchTree(roots[i], models[i + 1], data[i]); });
+  }
+  searchTree(node, models[0], g);
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  for (size_t i = 0; i < workers; i++) {
+    mergeRoot(node, roots[i], g);
+    // the move counts once, however many trees searched it.
+    data[i].stats.searches = 0;
+    g.stats += data[i].stats;
+    delete roots[i];
+  }
+
+  return finishSearch(node, temperature, g);
+}
+
+void pruneTree(Node *root, GlobalData &g) {
+  g.stats.prunes += 1;
+
+  // only nodes below root are searched for transposition edges into what
+  // is freed, so root must be its parent's only live child, as advanceRoot
+  // leaves it. the extra roots of a root-parallel search are not their
+  // parent's children at all.
+  if (root->parent != nullptr) {
+    bool child = false;
+    bool siblings = false;
+    for (const Edge &edge : root->parent->edges) {
+      child = child || edge.child == root;
+      siblings = siblings || (edge.child != nullptr && edge.child != root);
+    }
+    assert(!child || !siblings);
+  }
+
+  // every owned edge below the root's children is a candidate, least
+  // visited first and deepest first among equals.
+  struct Candidate {
+    Node *parent;
+    Edge *edge;
+    uint32_t depth;
+  };
+  std::vector<Candidate> candidates;
+  std::vector<std::pair<Node *, uint32_t>> stack = {{root, 0}};
+  while (!stack.empty()) {
+    auto [node, depth] = stack.back();
+    stack.pop_back();
+    for (Edge &edge : node->edges) {
+      if (!edge.owner) {
+        continue;
+      }
+      if (depth > 0) {
+        candidates.push_back({node, &edge, depth + 1});
+      }
+      stack.push_back({edge.child, depth + 1});
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Candidate &a, const Candidate &b) {
+              if (a.edge->visits != b.edge->visits) {
+                return a.edge->visits < b.edge->visits;
+              }
+              return a.depth > b.depth;
+            });
+
+  // marks whole subtrees as freed until the target is met. a candidate
+  // inside an already chosen subtree adds nothing.
+  const uint64_t target = g.treeBudget * PRUNE_TARGET;
+  std::unordered_set<Node *> freed;
+  std::vector<Candidate> chosen;
+  for (const Candidate &candidate : candidates) {
+    if (g.treeBytes <= target) {
+      break;
+    }
+    if (freed.count(candidate.edge->child)) {
+      continue;
+    }
+    std::vector<Node *> subtree = {candidate.edge->child};
+    while (!subtree.empty()) {
+      Node *node = subtree.back();
+      subtree.pop_back();
+      if (!freed.insert(node).second) {
+        continue;
+      }
+      g.treeBytes -= nodeBytes(node);
+      g.stats.nodesPruned += 1;
+      for (Edge &edge : node->edges) {
+        if (edge.owner) {
+          subtree.push_back(edge.child);
+        }
+      }
+    }
+    chosen.push_back(candidate);
+  }
+
+  // in a graph, transposition edges from the kept nodes can point into the
+  // freed subtrees.
+  if (g.graph) {
+    std::vector<Node *> kept = {root};
+    while (!kept.empty()) {
+      Node *node = kept.back();
+      kept.pop_back();
+      for (Edge &edge : node->edges) {
+        if (edge.child == nullptr) {
+          continue;
+        }
+        if (!edge.owner && freed.count(edge.child)) {
+          edge.child = nullptr;
+        } else if (edge.owner && !freed.count(edge.child)) {
+          kept.push_back(edge.child);
+        }
+      }
+    }
+    std::erase_if(g.transpositions,
+                  [&](const auto &entry) { return freed.count(entry.second); });
+  }
+
+  // a pruned edge keeps its visits, since the parent's stats still count
+  // them, and only loses its child. subtrees inside another chosen subtree
+  // go with it.
+  for (const Candidate &candidate : chosen) {
+    if (freed.count(candidate.parent)) {
+      continue;
+    }
+    delete candidate.edge->child;
+    candidate.edge->child = nullptr;
+    candidate.edge->owner = false;
+  }
+
+  // a tree that is mostly root children cannot get down to the target, and
+  // sorting it again after every batch would only repeat this prune. wait
+  // until it has grown by PRUNE_BACKOFF of the budget instead.
+  g.pruneFloor = 0;
+  if (g.treeBytes > target) {
+    g.pruneFloor = g.treeBytes + g.treeBudget * PRUNE_BACKOFF;
+  }
+}
+
+// relocates the subtree root owns into one block in breadth first order,
+// with fresh edge arrays allocated in the same order, so selection walks
+// neighbouring memory instead of wherever earlier searches left each node.
+// root itself moves to its own allocation, since it stays on the game path
+// as history long after the rest of the block is freed. returns root's new
+// address.
+static Node *compactTree(Node *root, GlobalData &g) {
+  std::vector<Node *> order = {root};
+  for (size_t i = 0; i < order.size(); i++) {
+    for (Edge &edge : order[i]->edges) {
+      if (edge.owner) {
+        order.push_back(edge.child);
+      }
+    }
+  }
+
+  NodeArena *arena = nullptr;
+  Node *slots = nullptr;
+  if (order.size() > 1) {
+    arena = new NodeArena{::operator new((order.size() - 1) * sizeof(Node)),
+                          order.size() - 1};
+    slots = static_cast<Node *>(arena->memory);
+  }
+
+  std::unordered_map<Node *, Node *> moved;
+  moved.reserve(order.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    Node *from = order[i];
+    Node *to = i == 0 ? new Node(from->parent, from->position)
+                      : new (slots + i - 1) Node(from->parent, from->position);
+    to->arena = i == 0 ? nullptr : arena;
+    to->threadIndex = from->threadIndex;
+    to->edges.assign(from->edges.begin(), from->edges.end());
+    to->totalValue = from->totalValue;
+    to->visitCount = from->visitCount;
+    to->batch_totalValue = from->batch_totalValue;
+    to->batch_visitCount = from->batch_visitCount;
+    to->initialized = from->initialized;
+    to->repetitions = from->repetitions;
+    to->planes = from->planes;
+    to->batchNum = from->batchNum;
+    to->valueEval = from->valueEval;
+    to->provenValue = from->provenValue;
+    g.treeBytes -= (from->edges.capacity() - to->edges.capacity()) *
+                   sizeof(Edge);
+    moved[from] = to;
+  }
+
+  for (auto [from, to] : moved) {
+    auto parent = moved.find(to->parent);
+    if (parent != moved.end()) {
+      to->parent = parent->second;
+    }
+    for (Edge &edge : to->edges) {
+      auto child = moved.find(edge.child);
+      if (child != moved.end()) {
+        edge.child = child->second;
+      }
+    }
+  }
+  if (root->parent != nullptr) {
+    edgeTo(root->parent, root).child = moved[root];
+  }
+  for (auto &[key, node] : g.transpositions) {
+    node = moved[node];
+  }
+
+  // the old nodes no longer own anything, so each delete frees one node.
+  for (Node *from : order) {
+    from->edges.clear();
+    delete from;
+  }
+  g.stats.nodesCompacted += order.size();
+  return moved[root];
+}
+
+Node *advanceRoot(Node *root, Node *selected, GlobalData &g) {
+  if (g.graph) {
+    // selected can reach nodes owned by the subtrees about to be freed, so
+    // everything it reaches is handed to the edge it is first found through,
+    // and the transposition table keeps only those nodes.
+    std::unordered_map<Node *, std::pair<Node *, Edge *>> reached = {
+        {selected, {root, &edgeTo(root, selected)}}};
+    std::vector<Node *> stack = {selected};
+    while (!stack.empty()) {
+      Node *node = stack.back();
+      stack.pop_back();
+      for (Edge &edge : node->edges) {
+        if (edge.child != nullptr &&
+            reached.emplace(edge.child, std::make_pair(node, &edge)).second) {
+          stack.push_back(edge.child);
+        }
+      }
+    }
+
+    g.transpositions.clear();
+    for (auto &[node, found] : reached) {
+      for (Edge &edge : node->parent->edges) {
+        if (edge.child == node) {
+          edge.owner = false;
+        }
+      }
+      node->parent = found.first;
+      found.second->owner = true;
+      if (node->repetitions >= 0) {
+        g.transpositions[graphKey(node->position.hash(), node->repetitions)] =
+            node;
+      }
+    }
+  }
+
+  for (Edge &edge : root->edges) {
+    if (edge.child != selected && edge.owner) {
+      g.treeBytes -= ownedBytes(edge.child);
+      delete edge.child;
+    }
+  }
+  // the new root's children are pruning candidates again.
+  g.pruneFloor = 0;
+  std::erase_if(root->edges,
+                [&](const Edge &edge) { return edge.child != selected; });
+
+  if (!g.compact) {
+    return selected;
+  }
+  auto start = std::chrono::steady_clock::now();
+  Node *compacted = compactTree(selected, g);
+  g.stats.compactionTime += secondsSince(start);
+  return compacted;
+}
+
+Node *getNextMove(Node *node, DNN &model, float temperature, GlobalData &g) {
+  INSTRUMENT_TIMER(GET_NEXT_MOVE);
+  startSearch(node, g);
+  PendingBatch pending; // the batch out at the gpu evaluator thread.
+
+  while (!searchDone(node, g)) {
+    if (!gatherBatch(node, g)) {
+      continue;
+    }
+
+    if (g.remote != nullptr) {
+      RingSlot &slot = g.remote->next();
+      Eval outputs = Eval(torch::Tensor(), torch::Tensor());
+      // without the server the batch can never be backed up, so the search
+      // cannot finish.
+      if (!evaluateRemote(slot, outputs, g)) {
+        return nullptr;
+      }
+      backupBatch(outputs, g);
+      g.remote->release(slot);
+    } else if (g.device == torch::kCPU) {
+      torch::Tensor input = encodeBatch(g);
+
+      auto start = std::chrono::steady_clock::now();
+      Eval outputs = [&] {
+        INSTRUMENT_LATENCY(INFERENCE, INFERENCE_LATENCY_US);
+        return model->forward(input);
+      }();
+      g.stats.inferenceTime += secondsSince(start);
+
+      backupBatch(outputs, g);
+    } else {
+      Eval outputs = evaluateQueued(pending, g);
+      backupBatch(outputs, g);
+    }
+  }
+
+  return finishSearch(node, temperature, g);
+}
@@ -0,0 +1,66 @@
+#include "multiplex.h"
+#include "instrument.h"
+#include <chrono>
+
+void BatchEvaluator::flush() {
+  // resumed coroutines queue new requests, so work on a detached list.
+  std::vector<Request> requests;
+  requests.swap(pending);
+
+  std::vector<Request> pass;
+  int64_t size = 0;
+  for (Request &request : requests) {
+    int64_t rows = request.input.size(0);
+    if (!pass.empty() && size + rows > static_cast<int64_t>(maxBatch)) {
+      forward(pass);
+      pass.clear();
+      size = 0;
+    }
+    pass.push_back(request);
+    size += rows;
+  }
+  if (!pass.empty()) {
+    forward(pass);
+  }
+}
+
+void BatchEvaluator::forward(std::vector<Request> &requests) {
+  std::vector<torch::Tensor> inputs;
+  inputs.reserve(requests.size());
+  for (const Request &request : requests) {
+    inputs.push_back(request.input);
+  }
+  torch::Tensor input = torch::cat(inputs, 0).to(device);
+
+  auto start = std::chrono::steady_clock::now();
+  Eval outputs = [&] {
+    INSTRUMENT_LATENCY(INFERENCE, INFERENCE_LATENCY_US);
+    return model->forward(input);
+  }();
+  inferenceTime += std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  forwardPasses += 1;
+  positions += input.size(0);
+  INSTRUMENT_RECORD(BATCH_SIZE, input.size(0));
+
+  int64_t offset = 0;
+  for (Request &request : requests) {
+    int64_t size = request.input.size(0);
+    *request.outputs = Eval(outputs.value.narrow(0, offset, size),
+                            outputs.policy.narrow(0, offset, size));
+    offset += size;
+  }
+  for (Request &request : requests) {
+    request.handle.resume();
+  }
+}
+
+void runTasks(std::vector<SearchTask> &tasks, BatchEvaluator &evaluator) {
+  for (SearchTask &task : tasks) {
+    task.resume();
+  }
+  while (!evaluator.idle()) {
+    evaluator.flush();
+  }
+}
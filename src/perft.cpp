@@ -0,0 +1,237 @@
+#include "move_gen.h"
+#include "moves.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Midnight;
+
+// transposition cache of perft subtree counts. entries are written without
+// locks; the key is stored xored with the data so torn writes from two
+// threads are detected and treated as misses.
+class PerftCache {
+private:
+  struct Entry {
+    std::atomic<uint64_t> check{0};
+    std::atomic<uint64_t> data{0};
+  };
+
+  std::vector<Entry> table;
+  uint64_t mask;
+
+public:
+  // size is rounded down to a power of two entries.
+  explicit PerftCache(size_t megabytes) {
+    size_t entries = 1;
+    while (entries * 2 * sizeof(Entry) <= megabytes * 1024 * 1024) {
+      entries *= 2;
+    }
+    table = std::vector<Entry>(entries);
+    mask = entries - 1;
+  }
+
+  bool probe(uint64_t hash, int depth, uint64_t &nodes) const {
+    const Entry &entry = table[hash & mask];
+    uint64_t data = entry.data.load(std::memory_order_relaxed);
+    uint64_t check = entry.check.load(std::memory_order_relaxed);
+    if ((check ^ data) != hash || static_cast<int>(data & 0xff) != depth) {
+      return false;
+    }
+    nodes = data >> 8;
+    return true;
+  }
+
+  void store(uint64_t hash, int depth, uint64_t nodes) {
+    Entry &entry = table[hash & mask];
+    uint64_t data = nodes << 8 | static_cast<uint64_t>(depth);
+    entry.data.store(data, std::memory_order_relaxed);
+    entry.check.store(hash ^ data, std::memory_order_relaxed);
+  }
+};
+
+// counts the leaf nodes depth plies below board. the last ply is bulk counted
+// from the size of the move list instead of being played.
+template <Color color>
+uint64_t perft(Position &board, int depth, PerftCache *cache) {
+  MoveList<color> moves(board);
+  if (depth == 1) {
+    return moves.size();
+  }
+
+  uint64_t nodes = 0;
+  if (cache && cache->probe(board.hash(), depth, nodes)) {
+    return nodes;
+  }
+
+  for (Move move : moves) {
+    board.play<color>(move);
+    nodes += perft<~color>(board, depth - 1, cache);
+    board.undo<color>(move);
+  }
+
+  if (cache) {
+    cache->store(board.hash(), depth, nodes);
+  }
+  return nodes;
+}
+
+uint64_t perft(Position &board, int depth, PerftCache *cache) {
+  if (depth == 0) {
+    return 1;
+  }
+  return board.turn() == WHITE ? perft<WHITE>(board, depth, cache)
+                               : perft<BLACK>(board, depth, cache);
+}
+
+// splits the root moves between threads. every thread works on its own copy
+// of the board and returns the subtree count of each root move.
+std::vector<uint64_t> divide(const Position &root, int depth, int threads,
+                             PerftCache *cache, std::vector<Move> &moves) {
+  Position board = root;
+  MoveBuffer buffer;
+  generateMoves(board, buffer);
+  moves = std::vector<Move>(buffer.begin(), buffer.end());
+  std::vector<uint64_t> counts(moves.size());
+  std::atomic<size_t> next{0};
+
+  auto worker = [&]() {
+    for (size_t i = next++; i < moves.size(); i = next++) {
+      Position child = root;
+      playMove(child, moves[i]);
+      counts[i] = perft(child, depth - 1, cache);
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (int i = 0; i < threads; i++) {
+    pool.emplace_back(worker);
+  }
+  for (std::thread &thread : pool) {
+    thread.join();
+  }
+  return counts;
+}
+
+struct PerftPosition {
+  std::string name;
+  std::string fen;
+  int depth;
+  uint64_t nodes;
+};
+
+// standard positions with known node counts.
+static const std::vector<PerftPosition> PERFT_SUITE = {
+    {"start", START_FEN, 6, 119060324},
+    {"kiwipete", KIWIPETE_FEN, 5, 193690690},
+    {"endgame", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 6, 11030083},
+    {"promotions",
+     "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 5,
+     15833292},
+    {"talkchess", TALKCHESS_FEN, 5, 89941194},
+    {"middlegame",
+     "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 "
+     "10",
+     5, 164075551},
+};
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+static uint64_t sum(const std::vector<uint64_t> &counts) {
+  uint64_t total = 0;
+  for (uint64_t count : counts) {
+    total += count;
+  }
+  return total;
+}
+
+// usage:
+//   perft [-t threads] [-H cache MB]              runs PERFT_SUITE
+//   perft [-t threads] [-H cache MB] depth [fen]  divide on one position
+// a cache size of 0 disables the perft cache. the suite runs without one
+// by default, so its Mnps measure move generation rather than cache hits;
+// divide uses 64 MB.
+int main(int argc, char **argv) {
+  int threads = std::max(1u, std::thread::hardware_concurrency());
+  int cacheMB = -1;
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-t" && i + 1 < argc) {
+      threads = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "-H" && i + 1 < argc) {
+      cacheMB = std::max(0, std::atoi(argv[++i]));
+    } else {
+      args.push_back(arg);
+    }
+  }
+
+  if (cacheMB < 0) {
+    cacheMB = args.empty() ? 0 : 64;
+  }
+  PerftCache *cache = cacheMB > 0 ? new PerftCache(cacheMB) : nullptr;
+  int status = 0;
+
+  if (!args.empty()) {
+    int depth = std::max(1, std::atoi(args[0].c_str()));
+    std::string fen = START_FEN;
+    if (args.size() > 1) {
+      fen = args[1];
+      for (size_t i = 2; i < args.size(); i++) {
+        fen += " " + args[i];
+      }
+    }
+
+    Position board(fen);
+    std::vector<Move> moves;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint64_t> counts = divide(board, depth, threads, cache, moves);
+    double seconds = secondsSince(start);
+
+    for (size_t i = 0; i < moves.size(); i++) {
+      std::cout << moves[i] << ": " << counts[i] << "\n";
+    }
+    uint64_t nodes = sum(counts);
+    std::printf("\nnodes: %llu\ntime: %.3fs\nMnps: %.2f\n",
+                static_cast<unsigned long long>(nodes), seconds,
+                nodes / seconds / 1e6);
+  } else {
+    std::printf("%-12s %5s %12s %9s %9s\n", "position", "depth", "nodes",
+                "time", "Mnps");
+    uint64_t totalNodes = 0;
+    double totalSeconds = 0;
+    for (const PerftPosition &test : PERFT_SUITE) {
+      Position board(test.fen);
+      std::vector<Move> moves;
+      auto start = std::chrono::steady_clock::now();
+      uint64_t nodes = sum(divide(board, test.depth, threads, cache, moves));
+      double seconds = secondsSince(start);
+
+      std::printf("%-12s %5d %12llu %8.3fs %9.2f%s\n", test.name.c_str(),
+                  test.depth, static_cast<unsigned long long>(nodes), seconds,
+                  nodes / seconds / 1e6,
+                  nodes == test.nodes ? "" : "  MISMATCH");
+      if (nodes != test.nodes) {
+        std::printf("  expected %llu\n",
+                    static_cast<unsigned long long>(test.nodes));
+        status = 1;
+      }
+      totalNodes += nodes;
+      totalSeconds += seconds;
+    }
+    std::printf("%-12s %5s %12llu %8.3fs %9.2f\n", "total", "",
+                static_cast<unsigned long long>(totalNodes), totalSeconds,
+                totalNodes / totalSeconds / 1e6);
+  }
+
+  delete cache;
+  return status;
+}
@@ -0,0 +1,32 @@
+#include "policy_index.h"
+#include <algorithm>
+#include <cmath>
+
+static_assert(POLICY_SIZE == 64 * MOVE_PLANES);
+static_assert(computePolicyIndex(12, 28, 0) == 12 * MOVE_PLANES + 2 * 7 + 1,
+              "e2e4 is two squares north");
+static_assert(computePolicyIndex(6, 21, 0) == 6 * MOVE_PLANES + 56 + 7,
+              "g1f3 is a knight move");
+static_assert(computePolicyIndex(0, 9, 0) >= 0 &&
+                  computePolicyIndex(0, 9, 0) < 56,
+              "diagonals stay on the queen planes");
+static_assert(computePolicyIndex(0, 17, 0) == 56 + 0, "a1b3 is a knight move");
+static_assert(computePolicyIndex(1, 27, 0) < 0, "b1d4 is not a legal jump");
+
+void legalPriors(const float *logits, const LegalPolicy &legal,
+                 float *priors) {
+  const size_t n = legal.moves.size();
+  float maxLogit = -INFINITY;
+  for (size_t i = 0; i < n; i++) {
+    maxLogit = std::max(maxLogit, logits[legal.indices[i]]);
+  }
+
+  float total = 0;
+  for (size_t i = 0; i < n; i++) {
+    priors[i] = std::exp(logits[legal.indices[i]] - maxLogit);
+    total += priors[i];
+  }
+  for (size_t i = 0; i < n; i++) {
+    priors[i] /= total;
+  }
+}
@@ -0,0 +1,211 @@
+#include "scheduler.h"
+
+// spin rounds an idle worker makes before it sleeps. back-to-back batches
+// usually arrive within them.
+constexpr int IDLE_SPINS = 256;
+
+// the scheduler and worker index of the calling thread, if it is a worker.
+static thread_local const Scheduler *currentScheduler = nullptr;
+static thread_local int currentWorker = -1;
+
+bool TaskDeque::push(Task *task) {
+  int64_t b = bottom.load(std::memory_order_relaxed);
+  int64_t t = top.load(std::memory_order_acquire);
+  if (b - t >= CAPACITY) {
+    return false;
+  }
+  buffer[b & MASK].store(task, std::memory_order_relaxed);
+  // publishes the task to thieves, which load bottom with acquire.
+  bottom.store(b + 1, std::memory_order_release);
+  return true;
+}
+
+Task *TaskDeque::pop() {
+  int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+  bottom.store(b, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t t = top.load(std::memory_order_relaxed);
+
+  if (t > b) {
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  Task *task = buffer[b & MASK].load(std::memory_order_relaxed);
+  if (t == b) {
+    // the last task: race the thieves for it.
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed)) {
+      task = nullptr;
+    }
+    bottom.store(b + 1, std::memory_order_relaxed);
+  }
+  return task;
+}
+
+Task *TaskDeque::steal() {
+  int64_t t = top.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t b = bottom.load(std::memory_order_acquire);
+  if (t >= b) {
+    return nullptr;
+  }
+  Task *task = buffer[t & MASK].load(std::memory_order_relaxed);
+  if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                   std::memory_order_relaxed)) {
+    return nullptr;
+  }
+  return task;
+}
+
+Scheduler::Scheduler(int threads) {
+  for (int i = 0; i < threads; i++) {
+    deques.push_back(std::make_unique<TaskDeque>());
+  }
+  for (int i = 0; i < threads; i++) {
+    workers.emplace_back([this, i] { workerLoop(i); });
+  }
+}
+
+Scheduler::~Scheduler() {
+  {
+    std::lock_guard<std::mutex> guard(sleepLock);
+    stopping = true;
+  }
+  sleepSignal.notify_all();
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+}
+
+int Scheduler::workerIndex() const {
+  return currentScheduler == this ? currentWorker : -1;
+}
+
+void Scheduler::wake() {
+  epoch.fetch_add(1);
+  if (sleeping.load() > 0) {
+    std::lock_guard<std::mutex> guard(sleepLock);
+    sleepSignal.notify_all();
+  }
+}
+
+void Scheduler::wakeParked() {
+  std::lock_guard<std::mutex> guard(sleepLock);
+  parkSignal.notify_all();
+}
+
+void Scheduler::runTask(Task *task, int worker) {
+  std::atomic<int64_t> *pending = task->pending;
+  task->run(task, worker);
+  // the waiter may free pending once it reaches zero, so only parked is
+  // read after the decrement.
+  if (pending != nullptr && pending->fetch_sub(1) == 1 &&
+      parked.load() > 0) {
+    wakeParked();
+  }
+}
+
+Task *Scheduler::findTask(int self, bool takeInjected) {
+  if (self >= 0) {
+    if (Task *task = deques[self]->pop()) {
+      return task;
+    }
+  }
+
+  // chunks from outside the pool hold up the game that spawned them, so
+  // they go before stealing. any waiter may run them, as they are short.
+  if (injectedChunkCount.load() > 0) {
+    std::lock_guard<std::mutex> guard(injectLock);
+    if (!injectedChunks.empty()) {
+      Task *task = injectedChunks.front();
+      injectedChunks.pop_front();
+      injectedChunkCount.fetch_sub(1);
+      return task;
+    }
+  }
+
+  // steal starting after our own deque, so thieves spread out.
+  const int n = size();
+  for (int i = 1; i <= n; i++) {
+    int victim = (self + i + n) % n;
+    if (victim == self) {
+      continue;
+    }
+    if (Task *task = deques[victim]->steal()) {
+      return task;
+    }
+  }
+
+  if (takeInjected && injectedCount.load() > 0) {
+    std::lock_guard<std::mutex> guard(injectLock);
+    if (!injected.empty()) {
+      Task *task = injected.front();
+      injected.pop_front();
+      injectedCount.fetch_sub(1);
+      return task;
+    }
+  }
+  return nullptr;
+}
+
+void Scheduler::wait(const std::atomic<int64_t> &pending, bool takeInjected) {
+  int self = workerIndex();
+  while (pending.load(std::memory_order_acquire) > 0) {
+    if (Task *task = findTask(self, takeInjected)) {
+      runTask(task, self);
+    } else if (takeInjected) {
+      park(pending);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void Scheduler::park(const std::atomic<int64_t> &pending) {
+  // parked is raised before the checks, so the last runTask on pending and
+  // a queue from outside the pool either see it and notify, or happened
+  // before the checks and are seen by them.
+  std::unique_lock<std::mutex> lock(sleepLock);
+  parked.fetch_add(1);
+  parkSignal.wait(lock, [&] {
+    return pending.load() == 0 || injectedCount.load() > 0 ||
+           injectedChunkCount.load() > 0;
+  });
+  parked.fetch_sub(1);
+}
+
+void Scheduler::workerLoop(int index) {
+  currentScheduler = this;
+  currentWorker = index;
+
+  while (true) {
+    uint64_t seen = epoch.load();
+    Task *task = nullptr;
+    for (int spin = 0; spin < IDLE_SPINS && task == nullptr; spin++) {
+      task = findTask(index, true);
+      if (task == nullptr) {
+        std::this_thread::yield();
+      }
+    }
+    if (task != nullptr) {
+      runTask(task, index);
+      continue;
+    }
+
+    // the sleeping count is raised before epoch is checked again, so a
+    // spawn either sees a sleeper to notify or moves epoch first.
+    std::unique_lock<std::mutex> lock(sleepLock);
+    sleeping.fetch_add(1);
+    sleepSignal.wait(lock, [&] { return stopping || epoch.load() != seen; });
+    sleeping.fetch_sub(1);
+    if (stopping) {
+      return;
+    }
+  }
+}
+
+Scheduler &defaultScheduler() {
+  static Scheduler scheduler(
+      std::max(2u, std::thread::hardware_concurrency()));
+  return scheduler;
+}
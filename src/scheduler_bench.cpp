@@ -0,0 +1,228 @@
+#include "ctpl.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+// a task body of roughly work loop iterations, so dispatch cost can be
+// measured against tasks of different sizes.
+static void spin(int work) {
+  volatile int sink = 0;
+  for (int i = 0; i < work; i++) {
+    sink = sink + i;
+  }
+}
+
+// busy time spent in spinFor on this thread, in seconds.
+static thread_local double busySeconds = 0;
+
+// spins for duration, as a game's selection or a batch chunk would.
+static void spinFor(std::chrono::microseconds duration) {
+  auto start = std::chrono::steady_clock::now();
+  while (std::chrono::steady_clock::now() - start < duration) {
+  }
+  busySeconds += std::chrono::duration<double>(duration).count();
+}
+
+static double threadCpuSeconds() {
+  timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static double nanosecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// ctpl: one std::function and packaged_task per push, one future per task.
+static double benchCtpl(ctpl::thread_pool &pool, int tasks, int work) {
+  std::vector<std::future<void>> futures;
+  futures.reserve(tasks);
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < tasks; i++) {
+    futures.push_back(pool.push([work](int) { spin(work); }));
+  }
+  for (std::future<void> &future : futures) {
+    future.wait();
+  }
+  return nanosecondsSince(start) / tasks;
+}
+
+struct SpinTask : Task {
+  int work;
+};
+
+static void runSpin(Task *task, int) {
+  spin(static_cast<SpinTask *>(task)->work);
+}
+
+// tasks spawned from outside the pool go through the injection list.
+static double benchInjected(Scheduler &scheduler, int tasks, int work) {
+  std::vector<SpinTask> spawned(tasks);
+  std::atomic<int64_t> pending = tasks;
+  for (SpinTask &task : spawned) {
+    task.run = runSpin;
+    task.pending = &pending;
+    task.work = work;
+  }
+  auto start = std::chrono::steady_clock::now();
+  scheduler.spawn(spawned.data(), spawned.size());
+  scheduler.wait(pending, true);
+  return nanosecondsSince(start) / tasks;
+}
+
+// tasks spawned by a worker go on its own deque and are stolen from there,
+// which is how the encoder and expansion chunks of a game run.
+static double benchDeque(Scheduler &scheduler, int tasks, int work) {
+  double nanoseconds = 0;
+  std::atomic<int64_t> done = 1;
+  FunctionTask root(
+      [&](int) {
+        std::vector<SpinTask> spawned(tasks);
+        std::atomic<int64_t> pending = tasks;
+        for (SpinTask &task : spawned) {
+          task.run = runSpin;
+          task.pending = &pending;
+          task.work = work;
+        }
+        auto start = std::chrono::steady_clock::now();
+        scheduler.spawn(spawned.data(), spawned.size());
+        scheduler.wait(pending);
+        nanoseconds = nanosecondsSince(start);
+      },
+      &done);
+  scheduler.spawn(&root, 1);
+  scheduler.wait(done);
+  return nanoseconds / tasks;
+}
+
+// parallelFor with one index per chunk, from outside the pool.
+static double benchParallelFor(Scheduler &scheduler, int tasks, int work) {
+  auto start = std::chrono::steady_clock::now();
+  scheduler.parallelFor(0, tasks, 1, [work](int64_t begin, int64_t end) {
+    for (int64_t i = begin; i < end; i++) {
+      spin(work);
+    }
+  });
+  return nanosecondsSince(start) / tasks;
+}
+
+// runs more games than workers the way main does: whole-game tasks spawned
+// from outside the pool, each gathering and then expanding its batches with
+// parallelFor, while the main thread takes games in the top-level wait.
+// fails if a batch of a game on the main thread waited behind unstarted
+// games. then runs games that sleep as if on a gpu, and fails if the main
+// thread burned cpu once it had no game left.
+static int checkGames(int threads, int games) {
+  constexpr int BATCHES = 100;
+  constexpr int CHUNKS = 8;
+  const std::chrono::microseconds gather(1000);
+  const std::chrono::microseconds chunk(100);
+
+  Scheduler scheduler(threads);
+  std::atomic<int64_t> running = games;
+  double slowestBatch = 0; // seconds, of the games on the main thread.
+  std::vector<FunctionTask> tasks;
+  for (int i = 0; i < games; i++) {
+    tasks.emplace_back(
+        [&](int worker) {
+          for (int batch = 0; batch < BATCHES; batch++) {
+            spinFor(gather);
+            auto start = std::chrono::steady_clock::now();
+            scheduler.parallelFor(0, CHUNKS, 1, [&](int64_t, int64_t) {
+              spinFor(chunk);
+            });
+            if (worker < 0) {
+              slowestBatch =
+                  std::max(slowestBatch, nanosecondsSince(start) * 1e-9);
+            }
+          }
+        },
+        &running);
+  }
+  scheduler.spawn(tasks.data(), tasks.size());
+  scheduler.wait(running, true);
+
+  // game i sleeps i + 1 steps, so the main thread, which usually takes the
+  // first game, has the longest wait with nothing to run.
+  const std::chrono::milliseconds step(50);
+  std::atomic<int64_t> sleeping = threads + 1;
+  std::vector<FunctionTask> sleepers;
+  for (int i = 0; i <= threads; i++) {
+    sleepers.emplace_back(
+        [step, i](int) { std::this_thread::sleep_for(step * (i + 1)); },
+        &sleeping);
+  }
+  auto start = std::chrono::steady_clock::now();
+  double cpuStart = threadCpuSeconds();
+  scheduler.spawn(sleepers.data(), sleepers.size());
+  scheduler.wait(sleeping, true);
+  double idleCpu = threadCpuSeconds() - cpuStart;
+  double wall = nanosecondsSince(start) * 1e-9;
+
+  // a batch queued behind a game waits for most of that game.
+  double game = BATCHES * (gather + CHUNKS * chunk).count() * 1e-6;
+  bool stalled = slowestBatch > game / 2;
+  bool spun = idleCpu > 0.1 * wall;
+  std::printf("%d games of %.0f ms on %d workers: slowest main thread batch "
+              "%.1f ms\n",
+              games, game * 1000, threads, slowestBatch * 1000);
+  std::printf("sleeping games: main thread cpu %.1f ms over %.1f ms\n",
+              idleCpu * 1000, wall * 1000);
+  if (stalled || spun) {
+    std::printf("FAIL:%s%s\n", stalled ? " batch stalled" : "",
+                spun ? " main thread spun" : "");
+    return 1;
+  }
+  std::printf("ok\n");
+  return 0;
+}
+
+// compares per-task dispatch cost of ctpl::thread_pool and the work-stealing
+// Scheduler with the same number of threads, for empty and small tasks.
+// every figure is the best of rounds runs. scheduler_bench games runs
+// checkGames instead.
+// usage: scheduler_bench [threads] [tasks per round] [rounds]
+//        scheduler_bench games [threads] [games]
+int main(int argc, char **argv) {
+  if (argc > 1 && std::string(argv[1]) == "games") {
+    int threads = argc > 2 ? std::atoi(argv[2]) : 2;
+    int games = argc > 3 ? std::atoi(argv[3]) : 4 * threads;
+    return checkGames(std::max(threads, 1), std::max(games, 1));
+  }
+
+  int threads = argc > 1 ? std::atoi(argv[1])
+                         : std::max(2u, std::thread::hardware_concurrency());
+  // the default fits in one worker deque, so no spawn runs inline.
+  int tasks = argc > 2 ? std::atoi(argv[2]) : 4000;
+  int rounds = argc > 3 ? std::atoi(argv[3]) : 20;
+
+  ctpl::thread_pool pool(threads);
+  Scheduler scheduler(threads);
+
+  std::printf("%d threads, %d tasks per round, ns per task\n", threads,
+              tasks);
+  std::printf("%-8s %10s %10s %10s %12s\n", "work", "ctpl", "injected",
+              "deque", "parallelFor");
+  for (int work : {0, 100, 1000}) {
+    double ctpl = 1e18, injected = 1e18, deque = 1e18, parallelFor = 1e18;
+    for (int round = 0; round < rounds; round++) {
+      ctpl = std::min(ctpl, benchCtpl(pool, tasks, work));
+      injected = std::min(injected, benchInjected(scheduler, tasks, work));
+      deque = std::min(deque, benchDeque(scheduler, tasks, work));
+      parallelFor =
+          std::min(parallelFor, benchParallelFor(scheduler, tasks, work));
+    }
+    std::printf("%-8d %10.1f %10.1f %10.1f %12.1f\n", work, ctpl, injected,
+                deque, parallelFor);
+  }
+  return 0;
+}
@@ -0,0 +1,196 @@
+#include "shared_ring.h"
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <csignal>
+#include <new>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+constexpr uint64_t RING_MAGIC = 0x676e69726e6e6d63; // "cmnnring".
+
+// the steady clock in ms. it is the system's monotonic clock, so every
+// process on the host reads the same time.
+static int64_t steadyMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// header and channels start on separate cache lines.
+static size_t headerBytes() {
+  return (sizeof(RingHeader) + 63) / 64 * 64;
+}
+
+size_t SharedRing::regionBytes(uint32_t clients) {
+  return headerBytes() + clients * sizeof(RingChannel);
+}
+
+bool SharedRing::map(int fd, size_t size) {
+  memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    std::perror("mmap");
+    memory = nullptr;
+    return false;
+  }
+  bytes = size;
+  return true;
+}
+
+bool SharedRing::create(const std::string &_name, uint32_t clients) {
+  name = _name;
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    std::perror(name.c_str());
+    return false;
+  }
+  owner = true;
+  size_t size = regionBytes(clients);
+  if (ftruncate(fd, size) != 0) {
+    std::perror("ftruncate");
+    close(fd);
+    return false;
+  }
+  if (!map(fd, size)) {
+    return false;
+  }
+
+  for (uint32_t i = 0; i < clients; i++) {
+    new (&channel(i)) RingChannel();
+  }
+  RingHeader *created = new (memory) RingHeader();
+  created->clients = clients;
+  created->serverPid = getpid();
+  beat();
+  // clients check the magic last, once everything else is in place.
+  std::atomic_thread_fence(std::memory_order_release);
+  created->magic = RING_MAGIC;
+  return true;
+}
+
+bool SharedRing::open(const std::string &_name) {
+  name = _name;
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    std::perror(name.c_str());
+    return false;
+  }
+  // the header says how many channels follow.
+  RingHeader peek;
+  if (pread(fd, &peek, sizeof(peek), 0) != sizeof(peek) ||
+      peek.magic != RING_MAGIC) {
+    std::fprintf(stderr, "%s: not a ready inference ring\n", name.c_str());
+    close(fd);
+    return false;
+  }
+  return map(fd, regionBytes(peek.clients));
+}
+
+SharedRing::~SharedRing() {
+  if (memory != nullptr) {
+    munmap(memory, bytes);
+  }
+  if (owner) {
+    shm_unlink(name.c_str());
+  }
+}
+
+RingChannel &SharedRing::channel(uint32_t client) const {
+  char *channels = static_cast<char *>(memory) + headerBytes();
+  return reinterpret_cast<RingChannel *>(channels)[client];
+}
+
+void SharedRing::beat() { header().heartbeat.store(steadyMs()); }
+
+bool SharedRing::serverAlive() const {
+  if (!processAlive(header().serverPid)) {
+    return false;
+  }
+  int64_t since = steadyMs() - header().heartbeat.load();
+  return since <= std::chrono::milliseconds(RING_SERVER_TIMEOUT).count();
+}
+
+RingClient::RingClient(SharedRing &_ring, uint32_t client)
+    : ring(_ring), channel(_ring.channel(client)) {
+  assert(client < ring.header().clients);
+  bool expected = false;
+  attachedHere = channel.attached.compare_exchange_strong(expected, true);
+  if (!attachedHere) {
+    std::fprintf(stderr, "client %u is already attached\n", client);
+    return;
+  }
+  channel.clientPid = getpid();
+}
+
+RingClient::~RingClient() {
+  if (!attached()) {
+    return;
+  }
+  channel.detached = true;
+  ring.header().doorbell.fetch_add(1);
+  futexWake(ring.header().doorbell);
+}
+
+RingSlot &RingClient::next() {
+  RingSlot &slot = channel.slots[head % RING_SLOTS];
+  assert(slot.state.load() == SLOT_FREE);
+  return slot;
+}
+
+RingSlot &RingClient::submit(uint32_t count) {
+  assert(count <= RING_LEAVES);
+  RingSlot &slot = next();
+  slot.count = count;
+  slot.state.store(SLOT_REQUESTED, std::memory_order_release);
+  head++;
+  ring.header().doorbell.fetch_add(1);
+  futexWake(ring.header().doorbell);
+  return slot;
+}
+
+bool RingClient::wait(RingSlot &slot) {
+  uint32_t state;
+  while ((state = slot.state.load(std::memory_order_acquire)) !=
+         SLOT_ANSWERED) {
+    futexWait(slot.state, state, std::chrono::milliseconds(100));
+    // an answer wakes the futex, so the server is only checked after
+    // a timeout or a spurious wake.
+    if (slot.state.load(std::memory_order_acquire) != SLOT_ANSWERED &&
+        !ring.serverAlive()) {
+      std::fprintf(stderr, "inference server is gone, request dropped\n");
+      serverLost = true;
+      return false;
+    }
+  }
+  return true;
+}
+
+void RingClient::release(RingSlot &slot) {
+  slot.state.store(SLOT_FREE, std::memory_order_release);
+}
+
+bool processAlive(int32_t pid) {
+  // only ESRCH says the process is gone; EPERM means it runs as another
+  // user.
+  return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+void futexWait(std::atomic<uint32_t> &word, uint32_t expected,
+               std::chrono::milliseconds timeout) {
+  // the word is shared between processes, so this is a plain futex rather
+  // than the process private one std::atomic::wait uses.
+  timespec relative = {static_cast<time_t>(timeout.count() / 1000),
+                       static_cast<long>(timeout.count() % 1000 * 1000000)};
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT,
+          expected, &relative, nullptr, 0);
+}
+
+void futexWake(std::atomic<uint32_t> &word) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE, INT_MAX,
+          nullptr, nullptr, 0);
+}
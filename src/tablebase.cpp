@@ -0,0 +1,144 @@
+#include "tablebase.h"
+#include "moves.h"
+#include "policy_index.h"
+#include <mutex>
+#ifdef HAS_SYZYGY
+#include "tbprobe.h"
+#endif
+
+#ifdef HAS_SYZYGY
+
+// the position in the form Fathom takes it. returns false when Fathom
+// cannot probe it: too many pieces, or castling still possible.
+struct FathomPosition {
+  uint64_t white;
+  uint64_t black;
+  uint64_t kings;
+  uint64_t queens;
+  uint64_t rooks;
+  uint64_t bishops;
+  uint64_t knights;
+  uint64_t pawns;
+  unsigned ep;
+  bool turn;
+};
+
+static bool toFathom(const Midnight::SharedPosition &board,
+                     FathomPosition &position) {
+  using namespace Midnight;
+  position.white = board.occupancy<WHITE>();
+  position.black = board.occupancy<BLACK>();
+  if (static_cast<unsigned>(__builtin_popcountll(
+          position.white | position.black)) > TB_LARGEST) {
+    return false;
+  }
+  if (board.king_and_oo_rook_not_moved<WHITE>() ||
+      board.king_and_ooo_rook_not_moved<WHITE>() ||
+      board.king_and_oo_rook_not_moved<BLACK>() ||
+      board.king_and_ooo_rook_not_moved<BLACK>()) {
+    return false;
+  }
+
+  position.kings = board.pieces[WHITE_KING] | board.pieces[BLACK_KING];
+  position.queens = board.pieces[WHITE_QUEEN] | board.pieces[BLACK_QUEEN];
+  position.rooks = board.pieces[WHITE_ROOK] | board.pieces[BLACK_ROOK];
+  position.bishops = board.pieces[WHITE_BISHOP] | board.pieces[BLACK_BISHOP];
+  position.knights = board.pieces[WHITE_KNIGHT] | board.pieces[BLACK_KNIGHT];
+  position.pawns = board.pieces[WHITE_PAWN] | board.pieces[BLACK_PAWN];
+  position.ep = board.ep_square() == NO_SQUARE ? 0 : board.ep_square();
+  position.turn = board.turn() == WHITE;
+  return true;
+}
+
+static float wdlValue(unsigned wdl) {
+  switch (wdl) {
+  case TB_WIN:
+    return 1.0f;
+  case TB_LOSS:
+    return -1.0f;
+  default:
+    return 0.0f;
+  }
+}
+
+bool initTablebases(const std::string &path) {
+  return tb_init(path.c_str()) && TB_LARGEST > 0;
+}
+
+int tablebasePieces() { return TB_LARGEST; }
+
+bool probeWDL(const Midnight::SharedPosition &board, float &value) {
+  FathomPosition p;
+  if (!toFathom(board, p)) {
+    return false;
+  }
+
+  // the wdl tables ignore the fifty-move counter, so probe as if it were
+  // zero; cursed results are scored as draws anyway.
+  unsigned result =
+      tb_probe_wdl(p.white, p.black, p.kings, p.queens, p.rooks, p.bishops,
+                   p.knights, p.pawns, 0, 0, p.ep, p.turn);
+  if (result == TB_RESULT_FAILED) {
+    return false;
+  }
+  value = wdlValue(result);
+  return true;
+}
+
+bool probeRoot(const Midnight::SharedPosition &board, Midnight::Move &move,
+               float &value) {
+  FathomPosition p;
+  if (!toFathom(board, p)) {
+    return false;
+  }
+
+  // unlike the WDL probe, Fathom's root probe is not thread safe, and
+  // root-parallel search probes from every worker.
+  static std::mutex rootLock;
+  std::lock_guard<std::mutex> guard(rootLock);
+  unsigned result = tb_probe_root(p.white, p.black, p.kings, p.queens,
+                                  p.rooks, p.bishops, p.knights, p.pawns,
+                                  board.fifty_move_rule(), 0, p.ep, p.turn,
+                                  nullptr);
+  if (result == TB_RESULT_FAILED || result == TB_RESULT_CHECKMATE ||
+      result == TB_RESULT_STALEMATE) {
+    return false;
+  }
+
+  // fathom promotes to queen, rook, bishop, knight as 1 to 4, the policy
+  // promotion slots are knight, bishop, rook as 1 to 3 and queen as 0.
+  static const int PROMOTION_SLOT[5] = {0, 0, 3, 2, 1};
+  unsigned from = TB_GET_FROM(result);
+  unsigned to = TB_GET_TO(result);
+  unsigned promotes = TB_GET_PROMOTES(result);
+
+  Midnight::SharedPosition copy(board);
+  MoveBuffer legal;
+  generateMoves(copy, legal);
+  for (size_t i = 0; i < legal.size(); i++) {
+    Midnight::Move candidate = legal[i];
+    if (static_cast<unsigned>(candidate.from()) == from &&
+        static_cast<unsigned>(candidate.to()) == to &&
+        candidate.is_promotion() == (promotes != 0) &&
+        promotionSlot(candidate) == PROMOTION_SLOT[promotes]) {
+      move = candidate;
+      value = wdlValue(TB_GET_WDL(result));
+      return true;
+    }
+  }
+  return false;
+}
+
+#else
+
+bool initTablebases(const std::string &) { return false; }
+
+int tablebasePieces() { return 0; }
+
+bool probeWDL(const Midnight::SharedPosition &, float &) { return false; }
+
+bool probeRoot(const Midnight::SharedPosition &, Midnight::Move &, float &) {
+  return false;
+}
+
+#endif
@@ -0,0 +1,39 @@
+#include "time_manager.h"
+#include <algorithm>
+#include <limits>
+
+SearchLimits timedLimits(const Clock &clock) {
+  int movesToGo = clock.movesToGo > 0 ? clock.movesToGo : DEFAULT_MOVES_TO_GO;
+  int64_t available = std::max<int64_t>(clock.timeMs - MOVE_OVERHEAD_MS, 0);
+
+  // an even share of the clock plus most of the increment, but never more
+  // than a fixed share of what is left.
+  double budgetMs = static_cast<double>(available) / movesToGo +
+                    0.75 * clock.incrementMs;
+  budgetMs = std::min(budgetMs, MAX_MOVE_SHARE * available);
+
+  SearchLimits limits;
+  limits.simulations = std::numeric_limits<uint32_t>::max();
+  limits.seconds = std::max(budgetMs, 1.0) / 1000;
+  return limits;
+}
+
+bool outOfTime(const SearchLimits &limits, double elapsed, uint64_t batches) {
+  if (!limits.timed()) {
+    return false;
+  }
+  double perBatch = batches == 0 ? 0 : elapsed / batches;
+  return elapsed + perBatch > limits.seconds;
+}
+
+uint32_t remainingSimulations(const SearchLimits &limits, uint32_t simulations,
+                              double elapsed) {
+  uint32_t remaining =
+      simulations < limits.simulations ? limits.simulations - simulations : 0;
+  if (!limits.timed() || elapsed <= 0) {
+    return remaining;
+  }
+  double rate = simulations / elapsed;
+  double fits = std::max(rate * (limits.seconds - elapsed), 0.0);
+  return std::min<double>(remaining, fits);
+}